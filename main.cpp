@@ -8,9 +8,10 @@
 #include <string>
 //using the namespace std
 using namespace std;
-static int launchExe(const std::filesystem::path &relPath) {
+static int launchExe(const std::filesystem::path &relPath, const std::string &args = "") {
     std::filesystem::path exe = std::filesystem::current_path() / relPath;
     std::string cmd = "\"" + exe.string() + "\"";
+    if (!args.empty()) cmd += " " + args;
     return std::system(cmd.c_str());
 }
 //function prototypes
@@ -140,7 +141,7 @@ int main(){
     {
         int op;
         system("cls");
-        std::cout<<"Chess\n1.Play vs Stockfish(UCI)\n2.Play vs Random AI\n3.Play vs Human(local)\n4.Return to main menu\n";
+        std::cout<<"Chess\n1.Play vs Stockfish(UCI)\n2.Play vs Random AI\n3.Play vs Human(local)\n4.Play vs Search AI\n5.Return to main menu\n";
         std::cin>>op;
         switch (op){
         case 1:
@@ -153,14 +154,21 @@ int main(){
         case 2:
             {
                 system("cls");
-                int rc = launchExe("minorColection/chess.exe");
+                int rc = launchExe("minorColection/chess.exe", "--ai random");
                 if(rc != 0) std::cout << "system() returned " << rc << "\n";
                 break;
             }
             case 3:
             {
                 system("cls");
-                int rc = launchExe("minorColection/chess.exe");
+                int rc = launchExe("minorColection/chess.exe", "--ai none");
+                if(rc != 0) std::cout << "system() returned " << rc << "\n";
+                break;
+            }
+            case 4:
+            {
+                system("cls");
+                int rc = launchExe("minorColection/chess.exe", "--ai search");
                 if(rc != 0) std::cout << "system() returned " << rc << "\n";
                 break;
             }
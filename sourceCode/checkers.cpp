@@ -3,115 +3,971 @@
 #include <string>
 #include <sstream>
 #include <cctype>
+#include <cstdlib>
+#include <cstdint>
 #include <algorithm>
 #include <utility>
 #include <limits>
+#include <chrono>
+#include <cstring>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <random>
+#include <fstream>
+#include <iomanip>
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 using Pos = std::pair<int,int>; // row, col
+using u32 = std::uint32_t;
+using u64 = std::uint64_t;
 
 static void clearScreen() { std::system("cls"); }
 
-static bool inBounds(int r,int c){ return r>=0 && r<8 && c>=0 && c<8; }
+// ------------------------------------------------------
+// Bitboards
+// ------------------------------------------------------
+// The 32 dark squares are numbered row by row from the top: square
+// r*4 + c/2 is (row r, column c). Even rows use columns 1,3,5,7 and odd
+// rows 0,2,4,6, so a diagonal step is a shift by 3, 4 or 5 depending on the
+// row parity; the masks keep pieces on the board edge from wrapping.
+static const u32 EVEN_ROWS = 0x0F0F0F0Fu;
+static const u32 ODD_ROWS  = 0xF0F0F0F0u;
+static const u32 EVEN_NOT_RIGHT = 0x07070707u; // even rows, not column 7
+static const u32 ODD_NOT_LEFT   = 0xE0E0E0E0u; // odd rows, not column 0
+static const u32 TOP_ROW    = 0x0000000Fu;
+static const u32 BOTTOM_ROW = 0xF0000000u;
 
-static char pieceChar(int p){
-    switch(p){
-        case 1: return 'r'; // red man
-        case 2: return 'R'; // red king
-        case -1: return 'b'; // black man
-        case -2: return 'B'; // black king
-        default: return '.';
+enum Dir { UP_LEFT, UP_RIGHT, DOWN_LEFT, DOWN_RIGHT };
+
+static inline u32 step(u32 b, int dir){
+    switch(dir){
+        case UP_LEFT:    return ((b & EVEN_ROWS) >> 4) | ((b & ODD_NOT_LEFT) >> 5);
+        case UP_RIGHT:   return ((b & EVEN_NOT_RIGHT) >> 3) | ((b & ODD_ROWS) >> 4);
+        case DOWN_LEFT:  return ((b & EVEN_ROWS) << 4) | ((b & ODD_NOT_LEFT) << 3);
+        default:         return ((b & EVEN_NOT_RIGHT) << 5) | ((b & ODD_ROWS) << 4);
     }
 }
 
-static bool isOpponent(int p, int curPlayer){
-    if (p==0) return false;
-    return (p>0) != (curPlayer>0);
+static inline int lsb(u32 b){
+#if defined(_MSC_VER)
+    unsigned long i; _BitScanForward(&i, b); return (int)i;
+#else
+    return __builtin_ctz(b);
+#endif
+}
+
+static inline int popcount(u32 b){
+#if defined(_MSC_VER)
+    return (int)__popcnt(b);
+#else
+    return __builtin_popcount(b);
+#endif
 }
 
-// find capture sequences for a single piece (recursive)
-static void findCaptures(const std::vector<std::vector<int>>& board, int r, int c, 
-                         int player, std::vector<Pos> path, std::vector<std::vector<Pos>>& out, 
-                         std::vector<std::vector<int>> bcopy = {}, bool promoted = false)
-{
-    if (bcopy.empty()) bcopy = board;
-    int piece = bcopy[r][c];
-    bool king = (std::abs(piece) == 2) || promoted;
+static inline int toSquare(int r,int c){ return r*4 + c/2; }
+static inline Pos toPos(int sq){ int r = sq/4; return {r, (sq%4)*2 + (r%2==0 ? 1 : 0)}; }
+
+// Red (+1) starts at the bottom and moves up; black (-1) starts at the top.
+struct Board {
+    u32 red = 0, black = 0, kings = 0;
+
+    u32 own(int player) const { return player>0 ? red : black; }
+    u32 opp(int player) const { return player>0 ? black : red; }
+    u32 empty() const { return ~(red | black); }
+
+    // 1/2 red man/king, -1/-2 black man/king, 0 empty
+    int at(int r,int c) const {
+        if ((r+c)%2==0) return 0;
+        u32 bit = 1u << toSquare(r,c);
+        int kind = (kings & bit) ? 2 : 1;
+        if (red & bit) return kind;
+        if (black & bit) return -kind;
+        return 0;
+    }
+};
+
+static Board startBoard(){
+    Board b;
+    b.black = 0x00000FFFu; // rows 0-2
+    b.red   = 0xFFF00000u; // rows 5-7
+    return b;
+}
+
+// A move is the list of squares the piece visits; jumps also record the
+// pieces they remove. Fixed-size, so generation never allocates.
+struct Move {
+    std::uint8_t path[16];
+    int len = 0;
+    u32 captured = 0;
+    bool crowns = false; // a man reached the far row during the move
+};
+
+struct MoveList {
+    static const int CAPACITY = 256;
+    Move moves[CAPACITY];
+    int size = 0;
+    void push(const Move &m){ if (size < CAPACITY) moves[size++] = m; }
+};
+
+static inline int forwardDirs(int player, bool king, int dirs[4]){
+    if (king){ dirs[0]=UP_LEFT; dirs[1]=UP_RIGHT; dirs[2]=DOWN_LEFT; dirs[3]=DOWN_RIGHT; return 4; }
+    if (player>0){ dirs[0]=UP_LEFT; dirs[1]=UP_RIGHT; }
+    else { dirs[0]=DOWN_LEFT; dirs[1]=DOWN_RIGHT; }
+    return 2;
+}
+
+// Extends the jump sequence in `cur` from `at`; only complete sequences are
+// recorded. Captured pieces leave the board at once, as in the original
+// rules, and a man that reaches the far row keeps jumping as a king.
+static void jumpFrom(const Board &b, int player, u32 at, bool king, u32 empty, Move &cur, MoveList &out){
+    int dirs[4];
+    int n = forwardDirs(player, king, dirs);
+    u32 targets = b.opp(player) & ~cur.captured;
     bool any = false;
-    const int drs[4] = {-1,-1,1,1};
-    const int dcs[4] = {-1,1,-1,1};
-    for (int k=0;k<4;++k){
-        int dr = drs[k], dc = dcs[k];
-        // men only move forward (toward opponent) unless king
-        if (!king){
-            if (player>0 && dr>0) continue; // red moves up (-1)
-            if (player<0 && dr<0) continue; // black moves down (+1)
-        }
-        int mr = r+dr, mc = c+dc;
-        int lr = r+2*dr, lc = c+2*dc;
-        if (!inBounds(mr,mc) || !inBounds(lr,lc)) continue;
-        if (!isOpponent(bcopy[mr][mc], player)) continue;
-        if (bcopy[lr][lc] != 0) continue;
-        // perform capture on copy
-        auto nb = bcopy;
-        nb[mr][mc] = 0;
-        nb[lr][lc] = nb[r][c];
-        nb[r][c] = 0;
-        bool willPromote = promoted;
-        // promote if lands on last row
-        if (player>0 && lr==0) { nb[lr][lc] = 2; willPromote = true; }
-        if (player<0 && lr==7) { nb[lr][lc] = -2; willPromote = true; }
-        auto npath = path;
-        npath.emplace_back(lr,lc);
-        findCaptures(nb, lr, lc, player, npath, out, nb, willPromote);
+    for (int k=0;k<n;++k){
+        u32 mid = step(at, dirs[k]);
+        if (!(mid & targets)) continue;
+        u32 land = step(mid, dirs[k]);
+        if (!(land & empty)) continue;
+        bool crowns = !king && (land & (player>0 ? TOP_ROW : BOTTOM_ROW));
+        cur.path[cur.len++] = (std::uint8_t)lsb(land);
+        cur.captured |= mid;
+        bool wasCrowned = cur.crowns;
+        cur.crowns |= crowns;
+        jumpFrom(b, player, land, king || crowns, (empty | mid | at) & ~land, cur, out);
+        cur.crowns = wasCrowned;
+        cur.captured &= ~mid;
+        cur.len--;
         any = true;
     }
-    if (!any && path.size()>1){
-        // no further captures; record sequence
-        out.push_back(path);
+    if (!any && cur.len>1) out.push(cur);
+}
+
+// Pieces of `player` with at least one jump, found with whole-board shifts.
+static u32 jumpers(const Board &b, int player){
+    u32 empty = b.empty(), opp = b.opp(player), own = b.own(player), kings = own & b.kings;
+    u32 result = 0;
+    const int back[4] = {DOWN_RIGHT, DOWN_LEFT, UP_RIGHT, UP_LEFT};
+    for (int d=0; d<4; ++d){
+        bool forward = player>0 ? d<2 : d>=2;
+        u32 movers = forward ? own : kings;
+        // step back from an empty square over an opponent onto a mover
+        u32 victims = step(empty, back[d]) & opp;
+        result |= step(victims, back[d]) & movers;
     }
+    return result;
 }
 
-// find single-step moves for a piece (non-captures)
-static std::vector<std::vector<Pos>> findMoves(const std::vector<std::vector<int>>& board, int r, int c, int player){
-    std::vector<std::vector<Pos>> ret;
-    int piece = board[r][c];
-    bool king = (std::abs(piece)==2);
-    const int drs[4] = {-1,-1,1,1};
-    const int dcs[4] = {-1,1,-1,1};
-    for (int k=0;k<4;++k){
-        int dr=drs[k], dc=dcs[k];
-        if (!king){
-            if (player>0 && dr>0) continue; // red moves up
-            if (player<0 && dr<0) continue; // black moves down
+// All legal moves; captures are compulsory.
+static void generateMoves(const Board &b, int player, MoveList &out){
+    out.size = 0;
+    u32 empty = b.empty();
+    u32 js = jumpers(b, player);
+    if (js){
+        while (js){
+            int sq = lsb(js); js &= js-1;
+            u32 bit = 1u << sq;
+            Move cur;
+            cur.path[0] = (std::uint8_t)sq;
+            cur.len = 1;
+            jumpFrom(b, player, bit, (b.kings & bit) != 0, empty | bit, cur, out);
         }
-        int nr=r+dr, nc=c+dc;
-        if (!inBounds(nr,nc)) continue;
-        if (board[nr][nc]==0){
-            ret.push_back({{r,c},{nr,nc}});
+        return;
+    }
+    u32 own = b.own(player), kings = own & b.kings;
+    const int back[4] = {DOWN_RIGHT, DOWN_LEFT, UP_RIGHT, UP_LEFT};
+    for (int d=0; d<4; ++d){
+        bool forward = player>0 ? d<2 : d>=2;
+        u32 targets = step(forward ? own : kings, d) & empty;
+        while (targets){
+            int to = lsb(targets); targets &= targets-1;
+            Move m;
+            m.path[0] = (std::uint8_t)lsb(step(1u << to, back[d]));
+            m.path[1] = (std::uint8_t)to;
+            m.len = 2;
+            m.crowns = !(kings & (1u << m.path[0])) && ((1u << to) & (player>0 ? TOP_ROW : BOTTOM_ROW));
+            out.push(m);
         }
     }
-    return ret;
 }
 
-static bool hasAnyCaptures(const std::vector<std::vector<int>>& board, int player){
-    for (int r=0;r<8;++r) for (int c=0;c<8;++c){
-        if (board[r][c]==0) continue;
-        if ((board[r][c]>0) != (player>0)) continue;
-        std::vector<std::vector<Pos>> out;
-        std::vector<Pos> p = {{r,c}};
-        findCaptures(board,r,c,player,p,out);
-        if (!out.empty()) return true;
+static void makeMove(Board &b, int player, const Move &m){
+    u32 from = 1u << m.path[0], to = 1u << m.path[m.len-1];
+    u32 &own = player>0 ? b.red : b.black;
+    u32 &opp = player>0 ? b.black : b.red;
+    own ^= from | to;
+    opp &= ~m.captured;
+    bool king = (b.kings & from) || m.crowns;
+    b.kings &= ~(m.captured | from);
+    if (king) b.kings |= to;
+}
+
+static u64 perft(const Board &b, int player, int depth){
+    MoveList list;
+    generateMoves(b, player, list);
+    if (depth==1) return list.size;
+    u64 n = 0;
+    for (int i=0;i<list.size;++i){
+        Board next = b;
+        makeMove(next, player, list.moves[i]);
+        n += perft(next, -player, depth-1);
     }
-    return false;
+    return n;
 }
 
-static void printBoard(const std::vector<std::vector<int>>& board){
+// Leaf counts from the start position and the cost of one move listing.
+static int runPerft(int maxDepth){
+    Board b = startBoard();
+    for (int d=1; d<=maxDepth; ++d){
+        auto t0 = std::chrono::steady_clock::now();
+        u64 n = perft(b, -1, d);
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+        std::cout << "perft " << d << ": " << n << " (" << secs << " s, " << (u64)(n/std::max(secs,1e-9)) << " leaves/s)\n";
+    }
+    MoveList list;
+    const int reps = 1000000;
+    u64 sink = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i=0;i<reps;++i){ generateMoves(b, i&1 ? 1 : -1, list); sink += list.size; }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-t0).count() / reps;
+    std::cout << "move listing: " << ns << " ns (" << sink/reps << " moves)\n";
+    return 0;
+}
+
+// ------------------------------------------------------
+// Endgame database
+// ------------------------------------------------------
+// Every position with up to N pieces is solved exactly and stored as
+// win/loss/draw for the side to move. Positions are grouped in slices by
+// material (red men, red kings, black men, black kings) and numbered by a
+// perfect index: red men are a subset of the 28 squares they can stand on,
+// black men a subset of their 28 squares minus those red men, then red
+// and black kings subsets of whatever is left, each ranked with the
+// combinatorial number system. No index is wasted on an impossible
+// placement, so the tables need no "broken" entries.
+//
+// A slice depends on slices with fewer pieces (captures) and on slices
+// with one man fewer and one king more (crowning), so slices are solved
+// by piece count and then by ascending number of men. Within a slice both
+// sides' tables are resolved together in passes until nothing changes: a
+// position with a move into a lost position is won, one whose moves all
+// lead to won positions is lost, and what is left at the end is a draw.
+// Passes are split across threads; each value only ever changes once,
+// from unknown to final, so threads may read one another's results as
+// they go.
+//
+// Tables are written in blocks of EGDB_BLOCK values, five values per byte
+// (3^5 = 243), with bytes 243..245 followed by a count encoding a run of
+// identical five-value groups. A probe maps the file, finds the block
+// through a small offset table and decodes at most one block.
+enum EgdbValue { EGDB_DRAW = 0, EGDB_WIN = 1, EGDB_LOSS = 2 };
+static const u32 RED_MEN_SQUARES   = ~TOP_ROW;    // a red man on the top row is a king
+static const u32 BLACK_MEN_SQUARES = ~BOTTOM_ROW;
+static const int EGDB_MAX_PIECES = 8;
+static const int EGDB_BLOCK = 1000;               // values per block, a multiple of 5
+static const char EGDB_MAGIC[8] = {'A','S','Y','S','E','G','0','1'};
+
+static u64 binom[33][33];
+static std::vector<u64> menOffsets[EGDB_MAX_PIECES+1][EGDB_MAX_PIECES+1];
+
+struct EgdbHeader {
+    char magic[8];
+    std::uint32_t maxPieces;
+    std::uint32_t tables;
+};
+
+struct EgdbTable {
+    std::uint16_t material;
+    std::uint8_t side;     // 0 black to move, 1 red to move
+    std::uint8_t pad;
+    std::uint32_t blocks;
+    u64 positions;
+    u64 offset;            // u32 block starts [blocks+1], then the data
+};
+
+static inline int materialKey(int rm,int rk,int bm,int bk){ return rm | rk<<4 | bm<<8 | bk<<12; }
+
+static std::string materialName(int rm,int rk,int bm,int bk){
+    return std::string(rm,'r') + std::string(rk,'R') + " v " + std::string(bm,'b') + std::string(bk,'B');
+}
+
+// The p-th (0-based) set bit of `set`.
+static inline int selectBit(u32 set, int p){
+    while (p--) set &= set-1;
+    return lsb(set);
+}
+
+// Colex rank of `set` among the same-sized subsets of `universe`.
+static inline u64 rankSubset(u32 set, u32 universe){
+    u64 r = 0;
+    int i = 0;
+    for (u32 s=set; s; s &= s-1){
+        int sq = lsb(s);
+        r += binom[popcount(universe & ((1u << sq) - 1))][++i];
+    }
+    return r;
+}
+
+static u32 unrankSubset(u64 r, int k, u32 universe){
+    u32 set = 0;
+    int n = popcount(universe);
+    for (int i=k; i>=1; --i){
+        int p = i-1;
+        while (p+1 < n && binom[p+1][i] <= r) ++p;
+        r -= binom[p][i];
+        set |= 1u << selectBit(universe, p);
+        n = p;
+    }
+    return set;
+}
+
+// Binomials, plus for every pair of men counts the first index of each
+// red-men placement (the number of black-men placements varies with how
+// many red men stand on black's squares).
+static void initEgdbIndex(int maxPieces){
+    if (binom[0][0]) return;
+    for (int n=0;n<=32;++n){
+        binom[n][0] = 1;
+        for (int k=1;k<=n;++k) binom[n][k] = binom[n-1][k-1] + binom[n-1][k];
+    }
+    for (int rm=0; rm<=maxPieces; ++rm)
+        for (int bm=0; rm+bm<=maxPieces; ++bm){
+            std::vector<u64> &off = menOffsets[rm][bm];
+            u64 count = binom[28][rm];
+            off.assign(count+1, 0);
+            for (u64 r=0; r<count; ++r){
+                u32 redMen = unrankSubset(r, rm, RED_MEN_SQUARES);
+                off[r+1] = off[r] + binom[popcount(BLACK_MEN_SQUARES & ~redMen)][bm];
+            }
+        }
+}
+
+static u64 sliceSize(int rm,int rk,int bm,int bk){
+    int freeSquares = 32 - rm - bm;
+    return menOffsets[rm][bm].back() * binom[freeSquares][rk] * binom[freeSquares-rk][bk];
+}
+
+static u64 positionIndex(const Board &b){
+    u32 redMen = b.red & ~b.kings, blackMen = b.black & ~b.kings;
+    u32 redKings = b.red & b.kings, blackKings = b.black & b.kings;
+    int rm = popcount(redMen), bm = popcount(blackMen), rk = popcount(redKings), bk = popcount(blackKings);
+    int freeSquares = 32 - rm - bm;
+    u64 men = menOffsets[rm][bm][rankSubset(redMen, RED_MEN_SQUARES)] + rankSubset(blackMen, BLACK_MEN_SQUARES & ~redMen);
+    u32 kingSquares = ~(redMen | blackMen);
+    return (men * binom[freeSquares][rk] + rankSubset(redKings, kingSquares)) * binom[freeSquares-rk][bk]
+         + rankSubset(blackKings, kingSquares & ~redKings);
+}
+
+static Board positionAt(int rm,int rk,int bm,int bk, u64 index){
+    int freeSquares = 32 - rm - bm;
+    u64 nbk = binom[freeSquares-rk][bk], nrk = binom[freeSquares][rk];
+    u64 bkRank = index % nbk; index /= nbk;
+    u64 rkRank = index % nrk; index /= nrk;
+    const std::vector<u64> &off = menOffsets[rm][bm];
+    u64 redRank = std::upper_bound(off.begin(), off.end(), index) - off.begin() - 1;
+    u32 redMen = unrankSubset(redRank, rm, RED_MEN_SQUARES);
+    u32 blackMen = unrankSubset(index - off[redRank], bm, BLACK_MEN_SQUARES & ~redMen);
+    u32 kingSquares = ~(redMen | blackMen);
+    u32 redKings = unrankSubset(rkRank, rk, kingSquares);
+    u32 blackKings = unrankSubset(bkRank, bk, kingSquares & ~redKings);
+    Board b;
+    b.red = redMen | redKings;
+    b.black = blackMen | blackKings;
+    b.kings = redKings | blackKings;
+    return b;
+}
+
+// Five-values-per-byte groups with runs of equal groups collapsed.
+static void compressValues(const std::atomic<std::uint8_t> *v, u64 n, std::vector<std::uint32_t> &starts, std::vector<std::uint8_t> &data){
+    auto group = [&](u64 i){
+        int g = 0;
+        for (int k=4;k>=0;--k) g = g*3 + (i+k < n ? v[i+k].load(std::memory_order_relaxed) : 0);
+        return g;
+    };
+    auto uniform = [](int g){ return g==0 ? 0 : g==121 ? 1 : g==242 ? 2 : -1; };
+    for (u64 blockStart=0; blockStart<n; blockStart+=EGDB_BLOCK){
+        starts.push_back((std::uint32_t)data.size());
+        u64 end = std::min<u64>(blockStart + EGDB_BLOCK, n);
+        for (u64 i=blockStart; i<end; ){
+            int g = group(i), value = uniform(g);
+            int run = 1;
+            if (value >= 0)
+                while (run < 257 && i + 5*run < end && group(i + 5*run) == g) ++run;
+            if (run >= 2){
+                data.push_back((std::uint8_t)(243 + value));
+                data.push_back((std::uint8_t)(run - 2));
+            } else {
+                data.push_back((std::uint8_t)g);
+                run = 1;
+            }
+            i += 5*(u64)run;
+        }
+    }
+    starts.push_back((std::uint32_t)data.size());
+}
+
+static std::uint32_t loadU32(const unsigned char *p){ std::uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+static int egdbDecode(const unsigned char *table, std::uint32_t blocks, u64 index){
+    static const int POW3[5] = {1, 3, 9, 27, 81};
+    u64 block = index / EGDB_BLOCK;
+    if (block >= blocks) return -1;
+    const unsigned char *data = table + 4*(size_t(blocks)+1);
+    const unsigned char *p = data + loadU32(table + 4*block), *end = data + loadU32(table + 4*(block+1));
+    u64 group = (index % EGDB_BLOCK) / 5;
+    int digit = int(index % 5);
+    while (p < end){
+        if (*p < 243){
+            if (group == 0) return (*p / POW3[digit]) % 3;
+            --group;
+            ++p;
+        } else {
+            u64 run = u64(p[1]) + 2;
+            if (group < run) return *p - 243;
+            group -= run;
+            p += 2;
+        }
+    }
+    return -1;
+}
+
+// Read-only, memory-mapped view of a generated database.
+struct EndgameDb {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#endif
+    int maxPieces = 0;
+    std::vector<int> lookup; // materialKey*2 + side -> directory entry
+
+    EndgameDb() = default;
+    EndgameDb(const EndgameDb &) = delete;
+    EndgameDb &operator=(const EndgameDb &) = delete;
+    ~EndgameDb(){ close(); }
+
+    bool open(const std::string &path){
+        close();
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER len;
+        if (!GetFileSizeEx(file, &len)) { close(); return false; }
+        size = (size_t)len.QuadPart;
+        mapping = size ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        if (!mapping) { close(); return false; }
+        data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!data) { close(); return false; }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+        size = (size_t)st.st_size;
+        void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) { size = 0; return false; }
+        data = (const unsigned char *)p;
+#endif
+        EgdbHeader h;
+        if (size < sizeof h) { close(); return false; }
+        std::memcpy(&h, data, sizeof h);
+        if (std::memcmp(h.magic, EGDB_MAGIC, 8) != 0 || h.maxPieces > EGDB_MAX_PIECES ||
+            size < sizeof h + h.tables * sizeof(EgdbTable)) { close(); return false; }
+        maxPieces = (int)h.maxPieces;
+        lookup.assign(2 << 16, -1);
+        for (std::uint32_t i=0; i<h.tables; ++i){
+            EgdbTable t;
+            std::memcpy(&t, data + sizeof h + i*sizeof t, sizeof t);
+            if (t.offset + 4*(u64(t.blocks)+1) > size) { close(); return false; }
+            lookup[t.material*2 + t.side] = (int)i;
+        }
+        initEgdbIndex(maxPieces);
+        return true;
+    }
+
+    void close(){
+#if defined(_WIN32)
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap((void *)data, size);
+#endif
+        data = nullptr;
+        size = 0;
+        maxPieces = 0;
+        lookup.clear();
+    }
+
+    // EGDB_WIN/LOSS/DRAW for `player` to move, or -1 if not covered.
+    int probe(const Board &b, int player) const {
+        if (!data || popcount(b.red | b.black) > maxPieces) return -1;
+        if (!b.own(player)) return EGDB_LOSS;
+        if (!b.opp(player)) return EGDB_WIN;
+        u32 redMen = b.red & ~b.kings, blackMen = b.black & ~b.kings;
+        int key = materialKey(popcount(redMen), popcount(b.red & b.kings), popcount(blackMen), popcount(b.black & b.kings));
+        int entry = lookup[key*2 + (player>0)];
+        if (entry < 0) return -1;
+        EgdbTable t;
+        std::memcpy(&t, data + sizeof(EgdbHeader) + entry*sizeof t, sizeof t);
+        return egdbDecode(data + t.offset, t.blocks, positionIndex(b));
+    }
+};
+
+struct EgdbSlice {
+    int rm, rk, bm, bk;
+    u64 size;
+    std::unique_ptr<std::atomic<std::uint8_t>[]> values[2]; // by side: black, red to move
+};
+
+// Solves every slice up to `maxPieces` and writes them to `path`.
+static int runEgdbGen(int maxPieces, int threads, const std::string &path){
+    maxPieces = std::max(2, std::min(maxPieces, EGDB_MAX_PIECES));
+    threads = std::max(1, threads);
+    initEgdbIndex(maxPieces);
+    std::vector<EgdbSlice> slices;
+    for (int n=2; n<=maxPieces; ++n)
+        for (int men=0; men<=n; ++men)
+            for (int rm=0; rm<=men; ++rm)
+                for (int rk=0; rm+rk<=n-(men-rm); ++rk){
+                    int bm = men-rm, bk = n-rm-rk-bm;
+                    if (rm+rk==0 || bm+bk==0) continue;
+                    EgdbSlice s{rm, rk, bm, bk, sliceSize(rm, rk, bm, bk), {}};
+                    slices.push_back(std::move(s));
+                }
+    std::vector<int> sliceOf(1 << 16, -1);
+    for (size_t i=0;i<slices.size();++i){
+        const EgdbSlice &s = slices[i];
+        sliceOf[materialKey(s.rm, s.rk, s.bm, s.bk)] = (int)i;
+    }
+    auto lookup = [&](const Board &b, int player) -> int {
+        if (!b.own(player)) return EGDB_LOSS;
+        u32 redMen = b.red & ~b.kings, blackMen = b.black & ~b.kings;
+        const EgdbSlice &s = slices[sliceOf[materialKey(popcount(redMen), popcount(b.red & b.kings),
+                                                        popcount(blackMen), popcount(b.black & b.kings))]];
+        return s.values[player>0][positionIndex(b)].load(std::memory_order_relaxed);
+    };
+
+    std::cout << "Generating " << slices.size() << " slices up to " << maxPieces << " pieces with " << threads << " threads\n";
+    std::vector<EgdbTable> tables;
+    std::vector<std::vector<std::uint32_t>> starts;
+    std::vector<std::vector<std::uint8_t>> blobs;
+    u64 totalPositions = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (EgdbSlice &s : slices){
+        auto ts = std::chrono::steady_clock::now();
+        for (auto &v : s.values) v.reset(new std::atomic<std::uint8_t>[s.size]());
+        u64 total = 2*s.size;
+        int passes = 0;
+        while (true){
+            ++passes;
+            std::atomic<u64> next{0}, changed{0};
+            auto work = [&](){
+                MoveList list;
+                u64 local = 0;
+                for (u64 begin; (begin = next.fetch_add(4096)) < total; ){
+                    for (u64 i=begin, end=std::min(begin+4096, total); i<end; ++i){
+                        int side = i >= s.size;
+                        u64 index = side ? i - s.size : i;
+                        std::atomic<std::uint8_t> &value = s.values[side][index];
+                        if (value.load(std::memory_order_relaxed) != EGDB_DRAW) continue;
+                        int player = side ? 1 : -1;
+                        Board b = positionAt(s.rm, s.rk, s.bm, s.bk, index);
+                        generateMoves(b, player, list);
+                        int result = EGDB_LOSS;
+                        for (int k=0; k<list.size && result!=EGDB_WIN; ++k){
+                            Board child = b;
+                            makeMove(child, player, list.moves[k]);
+                            int v = lookup(child, -player);
+                            if (v == EGDB_LOSS) result = EGDB_WIN;
+                            else if (v != EGDB_WIN) result = EGDB_DRAW;
+                        }
+                        if (result != EGDB_DRAW){ value.store((std::uint8_t)result, std::memory_order_relaxed); ++local; }
+                    }
+                }
+                changed += local;
+            };
+            std::vector<std::thread> pool;
+            for (int t=1;t<threads;++t) pool.emplace_back(work);
+            work();
+            for (auto &t : pool) t.join();
+            if (!changed) break;
+        }
+        u64 counts[3] = {0, 0, 0};
+        u64 bytes = 0;
+        for (int side=0; side<2; ++side){
+            for (u64 i=0;i<s.size;++i) ++counts[s.values[side][i].load(std::memory_order_relaxed)];
+            EgdbTable t{};
+            t.material = (std::uint16_t)materialKey(s.rm, s.rk, s.bm, s.bk);
+            t.side = (std::uint8_t)side;
+            t.positions = s.size;
+            starts.emplace_back();
+            blobs.emplace_back();
+            compressValues(s.values[side].get(), s.size, starts.back(), blobs.back());
+            t.blocks = (std::uint32_t)starts.back().size() - 1;
+            tables.push_back(t);
+            bytes += 4*starts.back().size() + blobs.back().size();
+        }
+        totalPositions += total;
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-ts).count();
+        std::cout << std::left << std::setw(16) << materialName(s.rm, s.rk, s.bm, s.bk) << std::right
+                  << std::setw(11) << total << " positions " << std::setw(4) << passes << " passes  "
+                  << "W " << counts[EGDB_WIN] << " L " << counts[EGDB_LOSS] << " D " << counts[EGDB_DRAW]
+                  << "  " << bytes << " bytes  " << secs << " s\n";
+    }
+    double genSecs = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+
+    EgdbHeader h{};
+    std::memcpy(h.magic, EGDB_MAGIC, 8);
+    h.maxPieces = (std::uint32_t)maxPieces;
+    h.tables = (std::uint32_t)tables.size();
+    u64 offset = sizeof h + tables.size()*sizeof(EgdbTable);
+    for (size_t i=0;i<tables.size();++i){
+        tables[i].offset = offset;
+        offset += 4*starts[i].size() + blobs[i].size();
+    }
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write((const char *)&h, sizeof h);
+    out.write((const char *)tables.data(), tables.size()*sizeof(EgdbTable));
+    for (size_t i=0;i<tables.size();++i){
+        out.write((const char *)starts[i].data(), 4*starts[i].size());
+        out.write((const char *)blobs[i].data(), blobs[i].size());
+    }
+    out.close();
+    if (!out){ std::cerr << "Cannot write " << path << "\n"; return 1; }
+    std::cout << "Solved " << totalPositions << " positions in " << genSecs << " s; " << path << ": " << offset
+              << " bytes (" << std::setprecision(3) << 8.0*offset/std::max<u64>(totalPositions, 1)
+              << " bits/position, 2-bit packing would be " << totalPositions/4 << " bytes)\n" << std::setprecision(6);
+
+    // Probe the file back through the mapping, checking against the tables
+    // still in memory.
+    EndgameDb db;
+    if (!db.open(path)){ std::cerr << "Cannot map " << path << "\n"; return 1; }
+    std::mt19937_64 rng(1);
+    std::vector<std::pair<Board,int>> sample(1 << 16);
+    u64 mismatches = 0;
+    for (auto &p : sample){
+        const EgdbSlice &s = slices[rng() % slices.size()];
+        u64 index = rng() % s.size;
+        int side = int(rng() & 1);
+        p = {positionAt(s.rm, s.rk, s.bm, s.bk, index), side ? 1 : -1};
+        if (db.probe(p.first, p.second) != s.values[side][index].load(std::memory_order_relaxed)) ++mismatches;
+    }
+    const int reps = 1000000;
+    volatile int sink = 0;
+    auto tp = std::chrono::steady_clock::now();
+    for (int i=0;i<reps;++i){ const auto &p = sample[i & (sample.size()-1)]; sink = sink + db.probe(p.first, p.second); }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-tp).count() / reps;
+    std::cout << "probe: " << ns << " ns (" << mismatches << " mismatches in " << sample.size() << " checks)\n";
+    return mismatches ? 1 : 0;
+}
+
+// Probe latency of an existing database, cold (first touch of each page
+// after mapping) and warm.
+static int runEgdbProbe(const std::string &path){
+    EndgameDb db;
+    auto t0 = std::chrono::steady_clock::now();
+    if (!db.open(path)){ std::cerr << "Cannot open endgame database " << path << "\n"; return 1; }
+    double openUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now()-t0).count();
+    std::vector<std::array<int,4>> materials;
+    for (int key=0; key<(1 << 16); ++key)
+        if (db.lookup[key*2] >= 0) materials.push_back({key & 15, key>>4 & 15, key>>8 & 15, key>>12 & 15});
+    std::mt19937_64 rng(2);
+    std::vector<std::pair<Board,int>> sample(1 << 16);
+    for (auto &p : sample){
+        const auto &m = materials[rng() % materials.size()];
+        p = {positionAt(m[0], m[1], m[2], m[3], rng() % sliceSize(m[0], m[1], m[2], m[3])), rng() & 1 ? 1 : -1};
+    }
+    u64 counts[3] = {0, 0, 0};
+    for (int pass=0; pass<2; ++pass){
+        auto tp = std::chrono::steady_clock::now();
+        for (const auto &p : sample){
+            int v = db.probe(p.first, p.second);
+            if (v >= 0 && !pass) ++counts[v];
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-tp).count() / sample.size();
+        std::cout << (pass ? "warm" : "cold") << " probe: " << ns << " ns\n";
+    }
+    std::cout << path << ": " << db.size << " bytes, " << db.maxPieces << " pieces, " << materials.size() << " slices, opened in "
+              << openUs << " us; sample W " << counts[EGDB_WIN] << " L " << counts[EGDB_LOSS] << " D " << counts[EGDB_DRAW] << "\n";
+    return 0;
+}
+
+static std::string moveText(const Move &m){
+    std::string s;
+    for (int i=0;i<m.len;++i){
+        Pos p = toPos(m.path[i]);
+        if (i) s += m.captured ? ':' : ' ';
+        s += char('A'+p.second);
+        s += char('1'+p.first);
+    }
+    return s;
+}
+
+// ------------------------------------------------------
+// Computer player
+// ------------------------------------------------------
+// Iterative-deepening alpha-beta over the bitboard generator. A jump is
+// compulsory, so at the horizon the search keeps following captures until
+// the side to move has none (there is no standing pat while a capture is
+// pending); forced single replies do not use up depth. Positions are
+// hashed with Zobrist keys into a transposition table that also remembers
+// the best move's index, and a repeated position scores as a draw.
+static const int WIN_SCORE = 30000;
+static const int WIN_BOUND = WIN_SCORE - 1000;
+static const int MAX_PLY = 128;
+static const int DB_WIN = 20000;       // proven by the endgame database
+static const int DB_BOUND = DB_WIN - 5000;
+
+static u64 zobrist[4][32]; // red man, red king, black man, black king
+static u64 zobristRedToMove;
+
+static void initZobrist(){
+    u64 x = 0x9E3779B97F4A7C15ull;
+    auto next = [&](){ // splitmix64
+        u64 z = (x += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    };
+    for (auto &kind : zobrist) for (u64 &k : kind) k = next();
+    zobristRedToMove = next();
+}
+
+static u64 hashBoard(const Board &b, int player){
+    const u32 sets[4] = {b.red & ~b.kings, b.red & b.kings, b.black & ~b.kings, b.black & b.kings};
+    u64 h = player>0 ? zobristRedToMove : 0;
+    for (int k=0;k<4;++k)
+        for (u32 s=sets[k]; s; s &= s-1) h ^= zobrist[k][lsb(s)];
+    return h;
+}
+
+// Material, men's progress toward the crowning row, a guarded back row and
+// the centre; from the view of `player`.
+static int evaluate(const Board &b, int player){
+    const u32 CENTER = 0x00666600u;
+    u32 redMen = b.red & ~b.kings, blackMen = b.black & ~b.kings;
+    int score = 100*(popcount(redMen) - popcount(blackMen)) + 160*(popcount(b.red & b.kings) - popcount(b.black & b.kings));
+    for (u32 s=redMen; s; s &= s-1) score += 2*(7 - lsb(s)/4);
+    for (u32 s=blackMen; s; s &= s-1) score -= 2*(lsb(s)/4);
+    score += 8*(popcount(redMen & BOTTOM_ROW) - popcount(blackMen & TOP_ROW));
+    score += 4*(popcount(b.red & CENTER) - popcount(b.black & CENTER));
+    return player>0 ? score : -score;
+}
+
+// A database win for `winner`: the eval plus the winner's kings closing in
+// on the loser's pieces, so the search makes progress instead of shuffling
+// between positions that are all won.
+static int databaseWin(const Board &b, int winner){
+    int score = DB_WIN + evaluate(b, winner);
+    for (u32 s=b.own(winner) & b.kings; s; s &= s-1){
+        Pos k = toPos(lsb(s));
+        int nearest = 7;
+        for (u32 o=b.opp(winner); o; o &= o-1){
+            Pos q = toPos(lsb(o));
+            nearest = std::min(nearest, std::max(std::abs(k.first-q.first), std::abs(k.second-q.second)));
+        }
+        score -= 4*nearest;
+    }
+    return score;
+}
+
+struct TTEntry {
+    u64 key = 0;
+    std::int16_t score = 0;
+    std::int8_t depth = 0;
+    std::uint8_t bound = 0;   // EXACT, LOWER or UPPER
+    std::uint8_t move = 0xFF; // index into the generated move list
+};
+
+struct SearchInfo {
+    Move best;
+    int score = 0, depth = 0;
+    u64 nodes = 0;
+    double secs = 0;
+};
+
+struct CheckersAI {
+    enum { EXACT = 1, LOWER = 2, UPPER = 3 };
+    std::vector<TTEntry> tt;
+    u64 ttMask;
+    u64 nodes = 0;
+    std::chrono::steady_clock::time_point start;
+    int timeMs = 0;
+    bool stopped = false;
+    u64 path[MAX_PLY + 1024]; // game history, then the current line
+    int pathLen = 0;
+    int rootBest = 0;
+    const EndgameDb *egdb = nullptr;
+    int probeBelow = 33;      // probe positions with fewer pieces than this
+
+    explicit CheckersAI(int ttBits = 20) : tt(size_t(1) << ttBits), ttMask((u64(1) << ttBits) - 1) {}
+
+    static int toTT(int s, int ply){ return s >= WIN_BOUND ? s + ply : s <= -WIN_BOUND ? s - ply : s; }
+    static int fromTT(int s, int ply){ return s >= WIN_BOUND ? s - ply : s <= -WIN_BOUND ? s + ply : s; }
+
+    bool timeUp(){
+        if ((nodes & 1023) == 0 && timeMs > 0 &&
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count() >= timeMs)
+            stopped = true;
+        return stopped;
+    }
+
+    bool repeated(u64 key) const {
+        // same side to move, so every other entry
+        for (int i=pathLen-2; i>=0; i-=2) if (path[i]==key) return true;
+        return false;
+    }
+
+    int quiesce(const Board &b, int player, int alpha, int beta, int ply){
+        ++nodes;
+        if (timeUp()) return 0;
+        MoveList list;
+        generateMoves(b, player, list);
+        if (list.size==0) return -WIN_SCORE + ply;
+        if (!list.moves[0].captured || ply >= MAX_PLY) return evaluate(b, player);
+        for (int i=0;i<list.size;++i){
+            Board next = b;
+            makeMove(next, player, list.moves[i]);
+            int score = -quiesce(next, -player, -beta, -alpha, ply+1);
+            if (stopped) return 0;
+            if (score > alpha){ alpha = score; if (alpha >= beta) break; }
+        }
+        return alpha;
+    }
+
+    int search(const Board &b, int player, int depth, int alpha, int beta, int ply){
+        if (egdb && ply > 0 && popcount(b.red | b.black) < probeBelow){
+            int v = egdb->probe(b, player);
+            if (v >= 0){
+                ++nodes;
+                return v==EGDB_DRAW ? 0 : v==EGDB_WIN ? databaseWin(b, player) : -databaseWin(b, -player);
+            }
+        }
+        if (depth <= 0 || ply >= MAX_PLY) return quiesce(b, player, alpha, beta, ply);
+        ++nodes;
+        if (timeUp()) return 0;
+        u64 key = hashBoard(b, player);
+        if (ply > 0 && repeated(key)) return 0;
+        TTEntry &e = tt[key & ttMask];
+        int ttMove = -1;
+        if (e.key == key){
+            ttMove = e.move;
+            int s = fromTT(e.score, ply);
+            if (ply > 0 && e.depth >= depth &&
+                (e.bound==EXACT || (e.bound==LOWER && s >= beta) || (e.bound==UPPER && s <= alpha)))
+                return s;
+        }
+        MoveList list;
+        generateMoves(b, player, list);
+        if (list.size==0) return -WIN_SCORE + ply;
+        int nextDepth = list.size==1 ? depth : depth-1; // forced replies are free
+        int order[MoveList::CAPACITY];
+        for (int i=0;i<list.size;++i) order[i] = i;
+        if (ttMove > 0 && ttMove < list.size){ order[ttMove] = 0; order[0] = ttMove; }
+        int alphaIn = alpha, best = -WIN_SCORE - 1, bestIndex = 0;
+        path[pathLen++] = key;
+        for (int k=0;k<list.size;++k){
+            Board next = b;
+            makeMove(next, player, list.moves[order[k]]);
+            int score = -search(next, -player, nextDepth, -beta, -alpha, ply+1);
+            if (stopped) break;
+            if (score > best){ best = score; bestIndex = order[k]; }
+            if (score > alpha){ alpha = score; if (alpha >= beta) break; }
+        }
+        pathLen--;
+        if (stopped) return 0;
+        if (ply==0) rootBest = bestIndex;
+        e.key = key;
+        e.score = (std::int16_t)toTT(best, ply);
+        e.depth = (std::int8_t)std::min(depth, 127);
+        e.bound = best >= beta ? LOWER : best > alphaIn ? EXACT : UPPER;
+        e.move = (std::uint8_t)bestIndex;
+        return best;
+    }
+
+    // Searches until `maxDepth` or `limitMs` (0 = no limit); `history`
+    // holds the keys of the game's earlier positions.
+    SearchInfo think(const Board &b, int player, int limitMs, int maxDepth, const std::vector<u64> &history){
+        SearchInfo info;
+        start = std::chrono::steady_clock::now();
+        timeMs = limitMs;
+        nodes = 0;
+        stopped = false;
+        // With the root itself in the database every reply would be a
+        // cutoff and the search one ply deep; probe only after a capture
+        // then, and let the search play the ending out.
+        probeBelow = egdb && egdb->probe(b, player) >= 0 ? popcount(b.red | b.black) : 33;
+        MoveList root;
+        generateMoves(b, player, root);
+        if (root.size==0) return info;
+        info.best = root.moves[0];
+        if (root.size==1) return info;
+        for (int depth=1; depth<=maxDepth; ++depth){
+            pathLen = 0;
+            for (size_t i = history.size() > 1024 ? history.size()-1024 : 0; i<history.size(); ++i) path[pathLen++] = history[i];
+            int score = search(b, player, depth, -WIN_SCORE-1, WIN_SCORE+1, 0);
+            if (stopped) break;
+            info.best = root.moves[rootBest];
+            info.score = score;
+            info.depth = depth;
+            double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now()-start).count();
+            if (std::abs(score) >= WIN_BOUND || (limitMs > 0 && elapsed > limitMs/2)) break;
+        }
+        info.nodes = nodes;
+        info.secs = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+        return info;
+    }
+};
+
+static std::string formatScore(int score){
+    if (score >= WIN_BOUND) return "win in " + std::to_string(WIN_SCORE - score);
+    if (score <= -WIN_BOUND) return "loss in " + std::to_string(WIN_SCORE + score);
+    if (score >= DB_BOUND) return "database win";
+    if (score <= -DB_BOUND) return "database loss";
+    return std::to_string(score);
+}
+
+static std::string searchReport(const SearchInfo &info){
+    std::ostringstream out;
+    out << "depth " << info.depth << ", score " << formatScore(info.score) << ", " << info.nodes << " nodes, "
+        << (u64)(info.nodes / std::max(info.secs, 1e-9)) << " nps, " << info.secs << " s";
+    return out.str();
+}
+
+// Fixed-depth search from the start position, for comparing builds.
+static int runBench(int depth){
+    CheckersAI ai;
+    SearchInfo info = ai.think(startBoard(), -1, 0, depth, {});
+    std::cout << "best " << moveText(info.best) << "  " << searchReport(info) << "\n";
+    return 0;
+}
+
+static void printBoard(const Board& board){
     clearScreen();
     std::cout << "   A B C D E F G H\n";
     for (int r=0;r<8;++r){
         std::cout << (r+1<10? " ":"") << r+1 << " ";
         for (int c=0;c<8;++c){
-            char ch = pieceChar(board[r][c]);
+            int p = board.at(r,c);
+            char ch = p==1 ? 'r' : p==2 ? 'R' : p==-1 ? 'b' : p==-2 ? 'B' : '.';
             std::cout << ch << ' ';
         }
         std::cout << '\n';
@@ -149,129 +1005,114 @@ static bool parsePath(const std::string& s, std::vector<Pos>& out){
     return out.size()>=2;
 }
 
-static void applyMove(std::vector<std::vector<int>>& board, const std::vector<Pos>& path, int player){
-    Pos from = path.front();
-    int piece = board[from.first][from.second];
-    board[from.first][from.second] = 0;
-    for (size_t i=1;i<path.size();++i){
-        Pos to = path[i];
-        int dr = to.first - from.first;
-        int dc = to.second - from.second;
-        if (std::abs(dr)==2 && std::abs(dc)==2){
-            int mr = from.first + dr/2, mc = from.second + dc/2;
-            board[mr][mc] = 0; // capture
-        }
-        from = to;
+// The legal move whose squares match the typed path, or nullptr.
+static const Move* findMove(const MoveList &list, const std::vector<Pos> &path){
+    for (int i=0;i<list.size;++i){
+        const Move &m = list.moves[i];
+        if (m.len != (int)path.size()) continue;
+        bool same = true;
+        for (int k=0;k<m.len && same;++k)
+            same = (path[k].first+path[k].second)%2==1 && m.path[k]==toSquare(path[k].first, path[k].second);
+        if (same) return &m;
     }
-    Pos last = path.back();
-    // promote?
-    if (player>0 && last.first==0) piece = 2;
-    if (player<0 && last.first==7) piece = -2;
-    board[last.first][last.second] = piece;
+    return nullptr;
 }
 
-static bool anyLegalMoveForPlayer(const std::vector<std::vector<int>>& board, int player){
-    if (hasAnyCaptures(board, player)) return true;
-    for (int r=0;r<8;++r) for (int c=0;c<8;++c){
-        if (board[r][c]==0) continue;
-        if ((board[r][c]>0) != (player>0)) continue;
-        auto moves = findMoves(board,r,c,player);
-        if (!moves.empty()) return true;
-    }
-    return false;
-}
+int main(int argc, char** argv){
+    if (argc>1 && std::string(argv[1])=="perft")
+        return runPerft(argc>2 ? std::max(1, std::atoi(argv[2])) : 8);
+    initZobrist();
+    if (argc>1 && std::string(argv[1])=="bench")
+        return runBench(argc>2 ? std::max(1, std::atoi(argv[2])) : 12);
 
-int main(){
-    // initialize board
-    std::vector<std::vector<int>> board(8, std::vector<int>(8,0));
-    for (int r=0;r<3;++r){
-        for (int c=0;c<8;++c){
-            if ((r+c)%2==1) board[r][c] = -1; // black top
-        }
+    // --ai red|black|none picks the computer's colour without asking;
+    // --time MS is its thinking time per move; --egdb FILE the endgame
+    // database, used when present.
+    int computer = 0, thinkMs = 1000, threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    bool askComputer = true;
+    std::string egdbPath = "checkers.egdb";
+    for (int i=1;i<argc;++i){
+        std::string a = argv[i];
+        if (a=="--egdb" && i+1<argc) egdbPath = argv[++i];
+        else if (a=="--threads" && i+1<argc) threads = std::max(1, std::atoi(argv[++i]));
     }
-    for (int r=5;r<8;++r){
-        for (int c=0;c<8;++c){
-            if ((r+c)%2==1) board[r][c] = 1; // red bottom
-        }
+    if (argc>1 && std::string(argv[1])=="egdb-gen")
+        return runEgdbGen(argc>2 && isdigit((unsigned char)argv[2][0]) ? std::atoi(argv[2]) : 4, threads, egdbPath);
+    if (argc>1 && std::string(argv[1])=="egdb-probe")
+        return runEgdbProbe(egdbPath);
+    for (int i=1;i<argc;++i){
+        std::string a = argv[i];
+        if (a=="--ai" && i+1<argc){
+            std::string c = argv[++i];
+            computer = c=="red" ? 1 : c=="black" ? -1 : 0;
+            askComputer = false;
+        } else if (a=="--time" && i+1<argc) thinkMs = std::max(1, std::atoi(argv[++i]));
     }
 
-    int player = -1; // black starts (-1). Use -1 for black, +1 for red
     std::string line;
+    if (askComputer){
+        std::cout << "Play against the computer? (n = no, b = computer plays Black, r = computer plays Red): ";
+        std::getline(std::cin, line);
+        if (!line.empty()) computer = tolower((unsigned char)line[0])=='b' ? -1 : tolower((unsigned char)line[0])=='r' ? 1 : 0;
+    }
+
+    Board board = startBoard();
+    int player = -1; // black starts (-1). Use -1 for black, +1 for red
+    MoveList legal;
+    CheckersAI ai;
+    EndgameDb egdb;
+    if (egdb.open(egdbPath)) ai.egdb = &egdb;
+    std::vector<u64> history;  // keys of earlier positions, for repetitions
+    int quietPlies = 0;        // plies without a capture or a man moving
+    std::string lastInfo;
     while (true){
         printBoard(board);
+        if (!lastInfo.empty()) std::cout << lastInfo << '\n';
         std::cout << (player<0 ? "Black (b/B)":"Red (r/R)") << " to move.\n";
-        if (!anyLegalMoveForPlayer(board, player)){
+        int known = egdb.probe(board, player);
+        if (known >= 0)
+            std::cout << "Endgame database: " << (known==EGDB_WIN ? "win" : known==EGDB_LOSS ? "loss" : "draw")
+                      << " for " << (player<0 ? "Black" : "Red") << ".\n";
+        generateMoves(board, player, legal);
+        if (legal.size==0){
             std::cout << (player<0 ? "Black":"Red") << " has no moves. ";
             std::cout << (player<0 ? "Red wins.\n":"Black wins.\n");
             break;
         }
-        bool mustCapture = hasAnyCaptures(board, player);
+        if (quietPlies >= 80){
+            std::cout << "40 moves each without a capture or a man moving: draw.\n";
+            break;
+        }
+        const Move *mv = nullptr;
+        if (player==computer){
+            SearchInfo info = ai.think(board, player, thinkMs, MAX_PLY, history);
+            lastInfo = "Computer plays " + moveText(info.best) + " (" + searchReport(info) + ")";
+            history.push_back(hashBoard(board, player));
+            quietPlies = (info.best.captured || !(board.kings & (1u << info.best.path[0]))) ? 0 : quietPlies+1;
+            makeMove(board, player, info.best);
+            player = -player;
+            continue;
+        }
+        bool mustCapture = legal.moves[0].captured != 0;
         std::cout << "Enter move (e.g. B6 C5 or B6:C5:D3). ";
-        if (mustCapture) std::cout << "You must capture.\n";
+        if (mustCapture) std::cout << "You must capture (give the whole jump sequence).\n";
         else std::cout << '\n';
-        std::getline(std::cin, line);
+        if (!std::getline(std::cin, line)) break;
         if (line.empty()) continue;
         if (line=="q"||line=="Q") break;
         std::vector<Pos> path;
         if (!parsePath(line, path)){ std::cout << "Invalid input format. Press Enter to continue..."; std::getline(std::cin,line); continue; }
         // validate that starting square has player's piece
-        Pos start = path.front();
-        int piece = board[start.first][start.second];
+        int piece = board.at(path.front().first, path.front().second);
         if (piece==0 || ((piece>0) != (player>0))){ std::cout << "No your piece at start. Press Enter..."; std::getline(std::cin,line); continue; }
-        // determine if move is a valid capture sequence or simple move
-        bool isCapture = false;
-        bool legal = false;
-        // try captures list for this piece
-        std::vector<std::vector<Pos>> captures;
-        std::vector<Pos> pinit = {start};
-        findCaptures(board, start.first, start.second, player, pinit, captures);
-        if (!captures.empty()){
-            // normalize captures by comparing paths
-            for (auto &cap : captures){
-                if (cap == path){ legal = true; isCapture = true; break; }
-            }
-        }
-        if (!legal && !mustCapture){
-            // allow simple move check
-            auto moves = findMoves(board, start.first, start.second, player);
-            for (auto &m : moves){
-                if (m == path){ legal = true; isCapture = false; break; }
-            }
-        }
-        if (!legal){
+        mv = findMove(legal, path);
+        if (!mv){
             std::cout << "Illegal move. Press Enter to continue..."; std::getline(std::cin,line); continue;
         }
-        // apply move
-        applyMove(board, path, player);
-        // if capture and further capture available from landing, enforce multi-jump when user didn't provide full sequence
-        if (isCapture){
-            Pos last = path.back();
-            std::vector<std::vector<Pos>> more;
-            std::vector<Pos> p2 = { last };
-            findCaptures(board, last.first, last.second, player, p2, more);
-            if (!more.empty()){
-                // user must continue capturing; simple approach: allow multiple separate inputs (turn remains with same player)
-                printBoard(board);
-                std::cout << "Continue capture from " << char('A'+last.second) << (last.first+1) << ". Enter continuation path (e.g. " 
-                          << char('A'+last.second) << (last.first+1) << ":D4) or full chain originally.\n";
-                std::getline(std::cin,line);
-                if (line.empty()){ /* skip continue and keep turn */ }
-                else {
-                    std::vector<Pos> cont;
-                    if (parsePath(line, cont)){
-                        // if cont starts with same start, apply full cont (user could give entire chain)
-                        if (cont.front()==path.front()){
-                            applyMove(board, cont, player);
-                        } else if (cont.front()==last){
-                            // build combined path
-                            std::vector<Pos> combo = path;
-                            combo.insert(combo.end(), cont.begin()+1, cont.end());
-                            applyMove(board, combo, player);
-                        }
-                    }
-                }
-            }
-        }
+        history.push_back(hashBoard(board, player));
+        quietPlies = (mv->captured || !(board.kings & (1u << mv->path[0]))) ? 0 : quietPlies+1;
+        makeMove(board, player, *mv);
+        lastInfo.clear();
         // switch turn
         player = -player;
     }
@@ -279,4 +1120,4 @@ int main(){
     std::cout << "Game over. Press Enter to exit...";
     std::getline(std::cin,line);
     return 0;
-}
\ No newline at end of file
+}
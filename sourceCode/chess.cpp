@@ -8,294 +8,3860 @@
 #include <limits>
 #include <cstdlib>
 #include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <fstream>
+#include <iomanip>
+#include <string_view>
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__BMI2__) || defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
-using Board = std::vector<std::string>; // 8x8, '.' empty
+using U64 = std::uint64_t;
 
+// ------------------------------------------------------
+// Bitboards and attack tables
+// ------------------------------------------------------
+// Squares are numbered a1=0 .. h8=63 (rank*8 + file). Row 0 of the printed
+// board (rank 8) is therefore squares 56..63.
+enum Color { WHITE, BLACK };
+enum PieceType { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
+enum Piece { WP, WN, WB, WR, WQ, WK, BP, BN, BB, BR, BQ, BK, NO_PIECE };
+enum Castling { WHITE_OO = 1, WHITE_OOO = 2, BLACK_OO = 4, BLACK_OOO = 8 };
+
+static inline U64 bit(int sq){ return 1ULL << sq; }
+static inline int makePiece(int color, int type){ return color*6 + type; }
+static inline int colorOf(int piece){ return piece >= BP; }
+static inline int typeOf(int piece){ return piece % 6; }
+
+static inline int lsb(U64 b){
+#if defined(_MSC_VER)
+    unsigned long idx; _BitScanForward64(&idx, b); return (int)idx;
+#else
+    return __builtin_ctzll(b);
+#endif
+}
+static inline int popcount(U64 b){
+#if defined(_MSC_VER)
+    return (int)__popcnt64(b);
+#else
+    return __builtin_popcountll(b);
+#endif
+}
+static inline int popLsb(U64 &b){ int s = lsb(b); b &= b - 1; return s; }
+
+struct Magic {
+    U64 mask;
+    U64 magic;
+    U64 *attacks;
+    unsigned shift;
+    unsigned index(U64 occ) const {
+#if defined(__BMI2__)
+        return (unsigned)_pext_u64(occ, mask);
+#else
+        return (unsigned)(((occ & mask) * magic) >> shift);
+#endif
+    }
+};
+
+static U64 knightAttacks[64], kingAttacks[64], pawnAttacks[2][64];
+static U64 rookTable[0x19000], bishopTable[0x1480];
+static Magic rookMagics[64], bishopMagics[64];
+static U64 betweenBB[64][64]; // squares strictly between two aligned squares
+static U64 lineBB[64][64];    // full line through two aligned squares
+
+static inline U64 rookAttacks(int sq, U64 occ){ return rookMagics[sq].attacks[rookMagics[sq].index(occ)]; }
+static inline U64 bishopAttacks(int sq, U64 occ){ return bishopMagics[sq].attacks[bishopMagics[sq].index(occ)]; }
+static inline U64 queenAttacks(int sq, U64 occ){ return rookAttacks(sq, occ) | bishopAttacks(sq, occ); }
+
+static U64 slidingAttack(int sq, U64 occ, const int (*dirs)[2]){
+    U64 att = 0;
+    for (int d=0; d<4; ++d) {
+        int r = sq/8 + dirs[d][0], f = sq%8 + dirs[d][1];
+        while (r>=0 && r<8 && f>=0 && f<8) {
+            att |= bit(r*8+f);
+            if (occ & bit(r*8+f)) break;
+            r += dirs[d][0]; f += dirs[d][1];
+        }
+    }
+    return att;
+}
+
+// Fills one slider table. Without BMI2 the magics are found at startup by
+// trial with sparse random numbers from fixed per-rank seeds, which takes a
+// few ms.
+static void initMagics(U64 *table, Magic *magics, const int (*dirs)[2]){
+#if !defined(__BMI2__)
+    static U64 occupancy[4096], reference[4096];
+    static int epoch[4096];
+    static const U64 rankSeeds[8] = {728, 10316, 55013, 32803, 12281, 15100, 16645, 255};
+    int attempt = 0;
+#endif
+    for (int sq=0; sq<64; ++sq) {
+        Magic &m = magics[sq];
+        U64 edges = ((0xFFULL | 0xFF00000000000000ULL) & ~(0xFFULL << (sq/8*8)))
+                  | ((0x0101010101010101ULL | 0x8080808080808080ULL) & ~(0x0101010101010101ULL << (sq%8)));
+        m.mask = slidingAttack(sq, 0, dirs) & ~edges;
+        m.shift = 64 - popcount(m.mask);
+        m.attacks = sq == 0 ? table : magics[sq-1].attacks + (1ULL << (64 - magics[sq-1].shift));
+        U64 sub = 0;
+#if defined(__BMI2__)
+        do {
+            m.attacks[_pext_u64(sub, m.mask)] = slidingAttack(sq, sub, dirs);
+            sub = (sub - m.mask) & m.mask;
+        } while (sub);
+#else
+        int size = 0;
+        do {
+            occupancy[size] = sub;
+            reference[size] = slidingAttack(sq, sub, dirs);
+            ++size;
+            sub = (sub - m.mask) & m.mask;
+        } while (sub);
+        U64 seed = rankSeeds[sq/8];
+        auto rand64 = [&seed](){
+            seed ^= seed >> 12; seed ^= seed << 25; seed ^= seed >> 27;
+            return seed * 2685821657736338717ULL;
+        };
+        for (int i=0; i<size; ) {
+            for (m.magic = 0; popcount((m.magic * m.mask) >> 56) < 6; )
+                m.magic = rand64() & rand64() & rand64();
+            ++attempt;
+            for (i=0; i<size; ++i) {
+                unsigned idx = m.index(occupancy[i]);
+                if (epoch[idx] < attempt) {
+                    epoch[idx] = attempt;
+                    m.attacks[idx] = reference[i];
+                } else if (m.attacks[idx] != reference[i]) break;
+            }
+        }
+#endif
+    }
+}
+
+static bool initAttackTables(){
+    static const int rookDirs[4][2] = {{1,0},{-1,0},{0,1},{0,-1}};
+    static const int bishopDirs[4][2] = {{1,1},{1,-1},{-1,1},{-1,-1}};
+    static const int knightSteps[8][2] = {{1,2},{2,1},{2,-1},{1,-2},{-1,-2},{-2,-1},{-2,1},{-1,2}};
+    for (int sq=0; sq<64; ++sq) {
+        int r = sq/8, f = sq%8;
+        for (auto &s : knightSteps) {
+            int nr = r+s[0], nf = f+s[1];
+            if (nr>=0 && nr<8 && nf>=0 && nf<8) knightAttacks[sq] |= bit(nr*8+nf);
+        }
+        for (int dr=-1; dr<=1; ++dr) for (int df=-1; df<=1; ++df) {
+            int nr = r+dr, nf = f+df;
+            if ((dr||df) && nr>=0 && nr<8 && nf>=0 && nf<8) kingAttacks[sq] |= bit(nr*8+nf);
+        }
+        for (int df=-1; df<=1; df+=2) {
+            if (f+df<0 || f+df>7) continue;
+            if (r<7) pawnAttacks[WHITE][sq] |= bit((r+1)*8+f+df);
+            if (r>0) pawnAttacks[BLACK][sq] |= bit((r-1)*8+f+df);
+        }
+    }
+    initMagics(rookTable, rookMagics, rookDirs);
+    initMagics(bishopTable, bishopMagics, bishopDirs);
+    for (int s1=0; s1<64; ++s1) for (int s2=0; s2<64; ++s2) {
+        if (s1 == s2) continue;
+        if (rookAttacks(s1, 0) & bit(s2)) {
+            lineBB[s1][s2] = (rookAttacks(s1, 0) & rookAttacks(s2, 0)) | bit(s1) | bit(s2);
+            betweenBB[s1][s2] = rookAttacks(s1, bit(s2)) & rookAttacks(s2, bit(s1));
+        } else if (bishopAttacks(s1, 0) & bit(s2)) {
+            lineBB[s1][s2] = (bishopAttacks(s1, 0) & bishopAttacks(s2, 0)) | bit(s1) | bit(s2);
+            betweenBB[s1][s2] = bishopAttacks(s1, bit(s2)) & bishopAttacks(s2, bit(s1));
+        }
+    }
+    return true;
+}
+static const bool attackTablesReady = initAttackTables();
+
+// Zobrist keys, laid out like Polyglot's Random64 table: 12*64 piece keys
+// indexed by kind = 2*type + isWhite, then 4 castling, 8 en-passant file
+// and 1 side-to-move key.
+enum { ZOBRIST_CASTLE = 768, ZOBRIST_EP = 772, ZOBRIST_TURN = 780, ZOBRIST_SIZE = 781 };
+static U64 zobrist[ZOBRIST_SIZE];
+static inline U64 pieceKey(int piece, int sq){ return zobrist[64*(2*typeOf(piece) + (colorOf(piece) == WHITE)) + sq]; }
+
+static bool initZobrist(){
+    U64 seed = 0x41535953u;
+    for (U64 &k : zobrist) {
+        U64 z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        k = z ^ (z >> 31);
+    }
+    return true;
+}
+static const bool zobristReady = initZobrist();
+
+// Replaces the keys with a 781-entry big-endian table, e.g. Polyglot's own
+// Random64 array, so Game::key matches the keys stored in Polyglot books.
+// Must run before any Game is set up.
+static bool loadZobristKeys(const std::string &path) {
+    FILE *f = std::fopen(path.c_str(), "rb");
+    if (!f) return false;
+    unsigned char buf[ZOBRIST_SIZE * 8];
+    bool ok = std::fread(buf, 1, sizeof(buf), f) == sizeof(buf);
+    std::fclose(f);
+    if (!ok) return false;
+    for (int i=0; i<ZOBRIST_SIZE; ++i) {
+        U64 k = 0;
+        for (int j=0; j<8; ++j) k = (k << 8) | buf[i*8 + j];
+        zobrist[i] = k;
+    }
+    return true;
+}
+
+// ------------------------------------------------------
+// Memory-mapped files
+// ------------------------------------------------------
+// Read-only view of a whole file. Pages are shared with the OS file cache,
+// so opening is O(1) and large files cost no private memory.
+struct MappedFile {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#endif
+
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string &path) {
+        close();
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER len;
+        if (!GetFileSizeEx(file, &len)) { close(); return false; }
+        size = (size_t)len.QuadPart;
+        if (size == 0) return true;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) { close(); return false; }
+        data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!data) { close(); return false; }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+        size = (size_t)st.st_size;
+        if (size > 0) {
+            void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) { ::close(fd); size = 0; return false; }
+            data = (const unsigned char *)p;
+        }
+        ::close(fd);
+#endif
+        return true;
+    }
+
+    void close() {
+#if defined(_WIN32)
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap((void *)data, size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
+static inline U64 readBigEndian(const unsigned char *p, int bytes) {
+    U64 v = 0;
+    for (int i=0; i<bytes; ++i) v = (v << 8) | p[i];
+    return v;
+}
+
+
+// ------------------------------------------------------
+// Evaluation network
+// ------------------------------------------------------
+// The evaluation is a 768 -> H feature layer (one input per piece type,
+// colour and square) kept per perspective in an int16 accumulator inside
+// Game, so make/unmake only add or subtract the columns of the pieces that
+// moved. With no weights file the layer is built from the piece-square
+// tables (lanes: middlegame, endgame, phase) and evaluation is the usual
+// tapered score; a weights file turns it into a small NNUE.
+static inline void vecAdd(std::int16_t *acc, const std::int16_t *w, int n) {
+#if defined(__AVX2__)
+    for (int i=0; i<n; i+=16) {
+        __m256i a = _mm256_load_si256((const __m256i*)(acc + i));
+        _mm256_store_si256((__m256i*)(acc + i), _mm256_add_epi16(a, _mm256_loadu_si256((const __m256i*)(w + i))));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (int i=0; i<n; i+=8) {
+        __m128i a = _mm_load_si128((const __m128i*)(acc + i));
+        _mm_store_si128((__m128i*)(acc + i), _mm_add_epi16(a, _mm_loadu_si128((const __m128i*)(w + i))));
+    }
+#else
+    for (int i=0; i<n; ++i) acc[i] = (std::int16_t)(acc[i] + w[i]);
+#endif
+}
+
+static inline void vecSub(std::int16_t *acc, const std::int16_t *w, int n) {
+#if defined(__AVX2__)
+    for (int i=0; i<n; i+=16) {
+        __m256i a = _mm256_load_si256((const __m256i*)(acc + i));
+        _mm256_store_si256((__m256i*)(acc + i), _mm256_sub_epi16(a, _mm256_loadu_si256((const __m256i*)(w + i))));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (int i=0; i<n; i+=8) {
+        __m128i a = _mm_load_si128((const __m128i*)(acc + i));
+        _mm_store_si128((__m128i*)(acc + i), _mm_sub_epi16(a, _mm_loadu_si128((const __m128i*)(w + i))));
+    }
+#else
+    for (int i=0; i<n; ++i) acc[i] = (std::int16_t)(acc[i] - w[i]);
+#endif
+}
+
+// acc += add - sub in one pass, for a piece sliding between two squares.
+static inline void vecSubAdd(std::int16_t *acc, const std::int16_t *sub, const std::int16_t *add, int n) {
+#if defined(__AVX2__)
+    for (int i=0; i<n; i+=16) {
+        __m256i a = _mm256_load_si256((const __m256i*)(acc + i));
+        a = _mm256_sub_epi16(a, _mm256_loadu_si256((const __m256i*)(sub + i)));
+        _mm256_store_si256((__m256i*)(acc + i), _mm256_add_epi16(a, _mm256_loadu_si256((const __m256i*)(add + i))));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (int i=0; i<n; i+=8) {
+        __m128i a = _mm_load_si128((const __m128i*)(acc + i));
+        a = _mm_sub_epi16(a, _mm_loadu_si128((const __m128i*)(sub + i)));
+        _mm_store_si128((__m128i*)(acc + i), _mm_add_epi16(a, _mm_loadu_si128((const __m128i*)(add + i))));
+    }
+#else
+    for (int i=0; i<n; ++i) acc[i] = (std::int16_t)(acc[i] - sub[i] + add[i]);
+#endif
+}
+
+// sum(clamp(acc, 0, 255) * w), the clipped-ReLU output layer.
+static inline std::int32_t dotClippedRelu(const std::int16_t *acc, const std::int16_t *w, int n) {
+#if defined(__AVX2__)
+    const __m256i zero = _mm256_setzero_si256(), qa = _mm256_set1_epi16(255);
+    __m256i sum = _mm256_setzero_si256();
+    for (int i=0; i<n; i+=16) {
+        __m256i a = _mm256_min_epi16(_mm256_max_epi16(_mm256_load_si256((const __m256i*)(acc + i)), zero), qa);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, _mm256_loadu_si256((const __m256i*)(w + i))));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i zero = _mm_setzero_si128(), qa = _mm_set1_epi16(255);
+    __m128i sum = _mm_setzero_si128();
+    for (int i=0; i<n; i+=8) {
+        __m128i a = _mm_min_epi16(_mm_max_epi16(_mm_load_si128((const __m128i*)(acc + i)), zero), qa);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(a, _mm_loadu_si128((const __m128i*)(w + i))));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+#else
+    std::int32_t sum = 0;
+    for (int i=0; i<n; ++i) sum += std::min(std::max((int)acc[i], 0), 255) * w[i];
+    return sum;
+#endif
+}
+
+// Piece-square tables from White's point of view, rank 8 first as printed.
+// Material is folded in at startup so a lookup gives the full term.
+static const int pieceValue[6] = {100, 320, 330, 500, 900, 0};
+static const int phaseWeight[6] = {0, 1, 1, 2, 4, 0};
+static const int pstSource[7][64] = {
+    { 0,  0,  0,  0,  0,  0,  0,  0,  50, 50, 50, 50, 50, 50, 50, 50,
+     10, 10, 20, 30, 30, 20, 10, 10,   5,  5, 10, 25, 25, 10,  5,  5,
+      0,  0,  0, 20, 20,  0,  0,  0,   5, -5,-10,  0,  0,-10, -5,  5,
+      5, 10, 10,-20,-20, 10, 10,  5,   0,  0,  0,  0,  0,  0,  0,  0},
+    {-50,-40,-30,-30,-30,-30,-40,-50, -40,-20,  0,  0,  0,  0,-20,-40,
+     -30,  0, 10, 15, 15, 10,  0,-30, -30,  5, 15, 20, 20, 15,  5,-30,
+     -30,  0, 15, 20, 20, 15,  0,-30, -30,  5, 10, 15, 15, 10,  5,-30,
+     -40,-20,  0,  5,  5,  0,-20,-40, -50,-40,-30,-30,-30,-30,-40,-50},
+    {-20,-10,-10,-10,-10,-10,-10,-20, -10,  0,  0,  0,  0,  0,  0,-10,
+     -10,  0,  5, 10, 10,  5,  0,-10, -10,  5,  5, 10, 10,  5,  5,-10,
+     -10,  0, 10, 10, 10, 10,  0,-10, -10, 10, 10, 10, 10, 10, 10,-10,
+     -10,  5,  0,  0,  0,  0,  5,-10, -20,-10,-10,-10,-10,-10,-10,-20},
+    {  0,  0,  0,  0,  0,  0,  0,  0,   5, 10, 10, 10, 10, 10, 10,  5,
+      -5,  0,  0,  0,  0,  0,  0, -5,  -5,  0,  0,  0,  0,  0,  0, -5,
+      -5,  0,  0,  0,  0,  0,  0, -5,  -5,  0,  0,  0,  0,  0,  0, -5,
+      -5,  0,  0,  0,  0,  0,  0, -5,   0,  0,  0,  5,  5,  0,  0,  0},
+    {-20,-10,-10, -5, -5,-10,-10,-20, -10,  0,  0,  0,  0,  0,  0,-10,
+     -10,  0,  5,  5,  5,  5,  0,-10,  -5,  0,  5,  5,  5,  5,  0, -5,
+       0,  0,  5,  5,  5,  5,  0, -5, -10,  5,  5,  5,  5,  5,  0,-10,
+     -10,  0,  5,  0,  0,  0,  0,-10, -20,-10,-10, -5, -5,-10,-10,-20},
+    {-30,-40,-40,-50,-50,-40,-40,-30, -30,-40,-40,-50,-50,-40,-40,-30,
+     -30,-40,-40,-50,-50,-40,-40,-30, -30,-40,-40,-50,-50,-40,-40,-30,
+     -20,-30,-30,-40,-40,-30,-30,-20, -10,-20,-20,-20,-20,-20,-20,-10,
+      20, 20,  0,  0,  0,  0, 20, 20,  20, 30, 10,  0,  0, 10, 30, 20},
+    {-50,-40,-30,-20,-20,-30,-40,-50, -30,-20,-10,  0,  0,-10,-20,-30,
+     -30,-10, 20, 30, 30, 20,-10,-30, -30,-10, 30, 40, 40, 30,-10,-30,
+     -30,-10, 30, 40, 40, 30,-10,-30, -30,-10, 20, 30, 30, 20,-10,-30,
+     -30,-30,  0,  0,  0,  0,-30,-30, -50,-30,-30,-30,-30,-30,-30,-50},
+};
+// Signed (White minus Black) middlegame and endgame terms per piece/square.
+static int pstMg[12][64], pstEg[12][64];
+
+// Quantisation of the NNUE output layer: clipped activations go up to 255,
+// output weights are scaled by 64, and 400 maps the result to centipawns.
+struct EvalNet {
+    static constexpr int MAX_HIDDEN = 512;
+    int hidden = 16;
+    bool pst = true;
+    std::vector<std::int16_t> weights;        // [768][hidden]
+    std::vector<std::int16_t> bias;           // [hidden]
+    std::vector<std::int16_t> outputWeights;  // [2][hidden]: side to move, then opponent
+    std::int32_t outputBias = 0;
+
+    // Feature column for a piece seen from one side: that side's own pieces
+    // come first and its board is flipped so it always plays "up".
+    const std::int16_t *column(int perspective, int piece, int sq) const {
+        int f = perspective == WHITE ? piece*64 + sq : ((piece + 6) % 12)*64 + (sq ^ 56);
+        return &weights[(size_t)f * hidden];
+    }
+
+    void buildFromPst() {
+        hidden = 16;
+        pst = true;
+        weights.assign(768 * 16, 0);
+        bias.assign(16, 0);
+        outputWeights.assign(32, 0);
+        outputBias = 0;
+        for (int p=0; p<12; ++p) for (int sq=0; sq<64; ++sq) {
+            std::int16_t *w = &weights[(size_t)(p*64 + sq) * 16];
+            w[0] = (std::int16_t)pstMg[p][sq];
+            w[1] = (std::int16_t)pstEg[p][sq];
+            w[2] = (std::int16_t)phaseWeight[typeOf(p)];
+        }
+    }
+
+    // Raw little-endian int16 file: feature weights, feature biases, output
+    // weights, output bias. The hidden size follows from the file size,
+    // which must be exactly 771*hidden+1 values: anything else is not a net.
+    bool load(const std::string &path) {
+        FILE *f = std::fopen(path.c_str(), "rb");
+        if (!f) return false;
+        std::fseek(f, 0, SEEK_END);
+        long bytes = std::ftell(f);
+        std::fseek(f, 0, SEEK_SET);
+        int h = bytes > 0 ? (int)std::min<long>((bytes / 2 - 1) / 771, MAX_HIDDEN + 1) : 0;
+        if (h <= 0 || h % 16 != 0 || h > MAX_HIDDEN || bytes != (771L * h + 1) * 2) {
+            std::fclose(f);
+            return false;
+        }
+        std::vector<std::int16_t> w(768 * (size_t)h), b(h), o(2 * (size_t)h);
+        std::int16_t ob = 0;
+        bool ok = std::fread(w.data(), 2, w.size(), f) == w.size()
+                && std::fread(b.data(), 2, b.size(), f) == b.size()
+                && std::fread(o.data(), 2, o.size(), f) == o.size()
+                && std::fread(&ob, 2, 1, f) == 1;
+        std::fclose(f);
+        if (!ok) return false;
+        hidden = h;
+        pst = false;
+        weights.swap(w);
+        bias.swap(b);
+        outputWeights.swap(o);
+        outputBias = ob;
+        return true;
+    }
+};
+static EvalNet evalNet;
+
+static bool initEvalNet(){
+    for (int p=0; p<12; ++p) for (int sq=0; sq<64; ++sq) {
+        int type = typeOf(p);
+        int idx = colorOf(p) == WHITE ? sq ^ 56 : sq;
+        int sign = colorOf(p) == WHITE ? 1 : -1;
+        pstMg[p][sq] = sign * (pieceValue[type] + pstSource[type][idx]);
+        pstEg[p][sq] = sign * (pieceValue[type] + pstSource[type == KING ? 6 : type][idx]);
+    }
+    evalNet.buildFromPst();
+    return true;
+}
+static const bool evalNetReady = initEvalNet();
+
+// ------------------------------------------------------
+// Game state
+// ------------------------------------------------------
 struct Game {
-    Board b;
+    // A move packed into 16 bits: from (6) | to (6) | flags (4).
+    struct Move {
+        enum Flag {
+            QUIET = 0, DOUBLE_PUSH = 1, KING_CASTLE = 2, QUEEN_CASTLE = 3,
+            CAPTURE = 4, EP_CAPTURE = 5, PROMO = 8, PROMO_CAPTURE = 12
+        };
+        std::uint16_t data = 0;
+
+        Move() = default;
+        Move(int from, int to, int flags) : data((std::uint16_t)(from | (to << 6) | (flags << 12))) {}
+        int from() const { return data & 63; }
+        int to() const { return (data >> 6) & 63; }
+        int flags() const { return data >> 12; }
+        bool isCapture() const { return (flags() & CAPTURE) != 0; }
+        bool isPromotion() const { return (flags() & PROMO) != 0; }
+        int promoType() const { return KNIGHT + (flags() & 3); }
+        char promo() const { return isPromotion() ? "nbrq"[flags() & 3] : 0; }
+        bool operator==(Move o) const { return data == o.data; }
+        bool operator!=(Move o) const { return data != o.data; }
+        std::string uci() const {
+            std::string s = { char('a' + from()%8), char('1' + from()/8), char('a' + to()%8), char('1' + to()/8) };
+            if (isPromotion()) s += promo();
+            return s;
+        }
+    };
+    struct MoveList {
+        Move moves[256];
+        int size = 0;
+        void add(int from, int to, int flags) { moves[size++] = Move(from, to, flags); }
+    };
+
+    U64 pieces[12];
+    U64 byColor[2];
+    U64 occupied;
+    std::uint8_t squares[64]; // Piece on each square, NO_PIECE if empty
     bool whiteToMove = true;
-    bool wkMoved = false, wqMoved = false;
-    bool bkMoved = false, bqMoved = false;
-    std::pair<int,int> enPassant = {-1,-1};
+    int castling = 0;         // Castling bits still available
+    int epSquare = -1;        // square a pawn may capture onto en-passant
+    int halfmoves = 0;
     int fullmoves = 1;
+    U64 key = 0;              // Zobrist key, kept up to date by make/unmake
+    const EvalNet *net = &evalNet;                        // weights behind acc
+    alignas(32) std::int16_t acc[2][EvalNet::MAX_HIDDEN]; // feature layer per perspective
+
+    // Undo stack: only what make() cannot recompute is stored. It is a
+    // fixed ring, so once full the oldest moves silently fall off the end.
+    struct Undo {
+        U64 key;          // key before the move, also used for repetitions
+        Move move;
+        std::uint8_t captured;
+        std::uint8_t castling;
+        std::int8_t epSquare;
+        std::uint16_t halfmoves;
+    };
+    static constexpr int HISTORY_CAP = 2048;
+    Undo history[HISTORY_CAP];
+    int plies = 0;     // moves made since reset; history[plies & mask] is the next slot
+    int undoable = 0;  // records still in the ring
+    int redoable = 0;  // undone moves that redo() can replay
+
+    bool canUndo() const { return undoable > 0; }
+    bool canRedo() const { return redoable > 0; }
+    bool undo() {
+        if (!canUndo()) return false;
+        unmake();
+        return true;
+    }
+    bool redo() {
+        if (!canRedo()) return false;
+        int left = redoable - 1;
+        make(history[plies & (HISTORY_CAP-1)].move);
+        redoable = left;
+        return true;
+    }
+    void clearHistory() { plies = undoable = redoable = 0; }
+
+    Game() { reset(); }
+
+    void clearBoard() {
+        std::fill(pieces, pieces+12, 0ULL);
+        byColor[0] = byColor[1] = occupied = 0;
+        std::fill(squares, squares+64, (std::uint8_t)NO_PIECE);
+        for (int c=0; c<2; ++c) std::copy(net->bias.begin(), net->bias.end(), acc[c]);
+    }
+
+    // Switches to another network and rebuilds the accumulator for it.
+    void setNet(const EvalNet *n) {
+        net = n;
+        for (int c=0; c<2; ++c) std::copy(net->bias.begin(), net->bias.end(), acc[c]);
+        for (U64 b = occupied; b; ) {
+            int sq = popLsb(b);
+            vecAdd(acc[WHITE], net->column(WHITE, squares[sq], sq), net->hidden);
+            vecAdd(acc[BLACK], net->column(BLACK, squares[sq], sq), net->hidden);
+        }
+    }
+
+    void reset() {
+        static const int backRank[8] = {ROOK, KNIGHT, BISHOP, QUEEN, KING, BISHOP, KNIGHT, ROOK};
+        clearBoard();
+        for (int f=0; f<8; ++f) {
+            putPiece(makePiece(WHITE, backRank[f]), f);
+            putPiece(makePiece(WHITE, PAWN), 8+f);
+            putPiece(makePiece(BLACK, PAWN), 48+f);
+            putPiece(makePiece(BLACK, backRank[f]), 56+f);
+        }
+        whiteToMove = true;
+        castling = WHITE_OO | WHITE_OOO | BLACK_OO | BLACK_OOO;
+        epSquare = -1;
+        halfmoves = 0;
+        fullmoves = 1;
+        key = computeKey();
+        clearHistory();
+    }
+
+    static constexpr const char *START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+    // Loads a FEN string. The move counters may be omitted. On failure the
+    // game is left in the start position.
+    bool setFen(const std::string &fen) {
+        std::istringstream in(fen);
+        std::string board, side, rights = "-", ep = "-";
+        int half = 0, full = 1;
+        in >> board >> side >> rights >> ep;
+        if (!(in >> half)) half = 0;
+        if (!(in >> full)) full = 1;
+        clearBoard();
+        clearHistory();
+        int rank = 7, file = 0;
+        bool ok = !board.empty() && (side == "w" || side == "b");
+        for (char ch : board) {
+            if (!ok) break;
+            if (ch == '/') { --rank; file = 0; ok = rank >= 0; }
+            else if (ch >= '1' && ch <= '8') { file += ch - '0'; ok = file <= 8; }
+            else {
+                const char *p = std::strchr("PNBRQKpnbrqk", ch);
+                ok = p && *p && file < 8;
+                if (ok) putPiece((int)(p - "PNBRQKpnbrqk"), rank*8 + file++);
+            }
+        }
+        ok = ok && popcount(pieces[WK]) == 1 && popcount(pieces[BK]) == 1;
+        if (!ok) { reset(); return false; }
+        whiteToMove = side == "w";
+        castling = 0;
+        for (char ch : rights) {
+            if (ch == 'K') castling |= WHITE_OO;
+            if (ch == 'Q') castling |= WHITE_OOO;
+            if (ch == 'k') castling |= BLACK_OO;
+            if (ch == 'q') castling |= BLACK_OOO;
+        }
+        // Drop rights the pieces on the board cannot back up.
+        if (squares[4] != WK) castling &= ~(WHITE_OO | WHITE_OOO);
+        if (squares[7] != WR) castling &= ~WHITE_OO;
+        if (squares[0] != WR) castling &= ~WHITE_OOO;
+        if (squares[60] != BK) castling &= ~(BLACK_OO | BLACK_OOO);
+        if (squares[63] != BR) castling &= ~BLACK_OO;
+        if (squares[56] != BR) castling &= ~BLACK_OOO;
+        epSquare = -1;
+        if (ep.size() == 2 && ep[0] >= 'a' && ep[0] <= 'h' && (ep[1] == '3' || ep[1] == '6'))
+            epSquare = (ep[1] - '1')*8 + (ep[0] - 'a');
+        halfmoves = half;
+        fullmoves = full;
+        key = computeKey();
+        return true;
+    }
+
+    std::string fen() const {
+        std::string out;
+        for (int rank=7; rank>=0; --rank) {
+            int gap = 0;
+            for (int file=0; file<8; ++file) {
+                int p = squares[rank*8 + file];
+                if (p == NO_PIECE) { ++gap; continue; }
+                if (gap) { out += char('0' + gap); gap = 0; }
+                out += pieceChar(p);
+            }
+            if (gap) out += char('0' + gap);
+            if (rank) out += '/';
+        }
+        out += whiteToMove ? " w " : " b ";
+        if (!castling) out += '-';
+        if (castling & WHITE_OO) out += 'K';
+        if (castling & WHITE_OOO) out += 'Q';
+        if (castling & BLACK_OO) out += 'k';
+        if (castling & BLACK_OOO) out += 'q';
+        out += ' ';
+        if (epSquare < 0) out += '-';
+        else { out += char('a' + epSquare%8); out += char('1' + epSquare/8); }
+        out += ' ' + std::to_string(halfmoves) + ' ' + std::to_string(fullmoves);
+        return out;
+    }
+
+    // Hash of the position from scratch. En-passant only counts when a pawn
+    // of the side to move could actually take, as in Polyglot.
+    U64 computeKey() const {
+        U64 k = 0;
+        for (U64 b = occupied; b; ) { int sq = popLsb(b); k ^= pieceKey(squares[sq], sq); }
+        k ^= castlingKey(castling) ^ epKey();
+        if (whiteToMove) k ^= zobrist[ZOBRIST_TURN];
+        return k;
+    }
+    static U64 castlingKey(int rights) {
+        U64 k = 0;
+        for (int i=0; i<4; ++i) if (rights & (1 << i)) k ^= zobrist[ZOBRIST_CASTLE + i];
+        return k;
+    }
+    U64 epKey() const {
+        int us = whiteToMove ? WHITE : BLACK;
+        if (epSquare >= 0 && (pawnAttacks[us ^ 1][epSquare] & pieces[makePiece(us, PAWN)]))
+            return zobrist[ZOBRIST_EP + epSquare%8];
+        return 0;
+    }
+
+    // True if the current position already occurred since the last capture
+    // or pawn move. Only same-side-to-move positions are compared, and the
+    // halfmove clock bounds the scan.
+    bool isRepetition() const {
+        int limit = std::min(halfmoves, undoable);
+        for (int i=4; i<=limit; i+=2)
+            if (history[(plies - i) & (HISTORY_CAP-1)].key == key) return true;
+        return false;
+    }
+    int repetitionCount() const {
+        int count = 1, limit = std::min(halfmoves, undoable);
+        for (int i=4; i<=limit; i+=2)
+            if (history[(plies - i) & (HISTORY_CAP-1)].key == key) ++count;
+        return count;
+    }
+
+    void putPiece(int p, int sq) {
+        pieces[p] |= bit(sq);
+        byColor[colorOf(p)] |= bit(sq);
+        occupied |= bit(sq);
+        squares[sq] = (std::uint8_t)p;
+        key ^= pieceKey(p, sq);
+        vecAdd(acc[WHITE], net->column(WHITE, p, sq), net->hidden);
+        vecAdd(acc[BLACK], net->column(BLACK, p, sq), net->hidden);
+    }
+    void removePiece(int sq) {
+        int p = squares[sq];
+        pieces[p] &= ~bit(sq);
+        byColor[colorOf(p)] &= ~bit(sq);
+        occupied &= ~bit(sq);
+        squares[sq] = NO_PIECE;
+        key ^= pieceKey(p, sq);
+        vecSub(acc[WHITE], net->column(WHITE, p, sq), net->hidden);
+        vecSub(acc[BLACK], net->column(BLACK, p, sq), net->hidden);
+    }
+    void movePiece(int from, int to) {
+        int p = squares[from];
+        U64 fromTo = bit(from) | bit(to);
+        pieces[p] ^= fromTo;
+        byColor[colorOf(p)] ^= fromTo;
+        occupied ^= fromTo;
+        squares[to] = (std::uint8_t)p;
+        squares[from] = NO_PIECE;
+        key ^= pieceKey(p, from) ^ pieceKey(p, to);
+        vecSubAdd(acc[WHITE], net->column(WHITE, p, from), net->column(WHITE, p, to), net->hidden);
+        vecSubAdd(acc[BLACK], net->column(BLACK, p, from), net->column(BLACK, p, to), net->hidden);
+    }
+
+    static int toSquare(int r,int c){ return (7-r)*8 + c; }
+    static int rowOf(int sq){ return 7 - sq/8; }
+    static int colOf(int sq){ return sq%8; }
+    static bool inBounds(int r,int c){ return r>=0 && r<8 && c>=0 && c<8; }
+
+    static char pieceChar(int p){ return p==NO_PIECE ? '.' : "PNBRQKpnbrqk"[p]; }
+
+    void print() const {
+        std::system("cls");
+        std::cout << "   a b c d e f g h\n";
+        for (int r=0;r<8;++r){
+            std::cout << 8-r << "  ";
+            for (int c=0;c<8;++c) std::cout << pieceChar(squares[toSquare(r,c)]) << ' ';
+            std::cout << " " << 8-r << "\n";
+        }
+        std::cout << "   a b c d e f g h\n";
+        std::cout << (whiteToMove ? "White" : "Black") << " to move"
+                  << "  (enter moves like e2e4 or e7e8q for promotion)\n";
+    }
+
+    static bool algToRC(const std::string &s, int &r, int &c){
+        if (s.size()<2) return false;
+        char f = std::tolower(s[0]);
+        char R = s[1];
+        if (f<'a' || f>'h' || R<'1' || R>'8') return false;
+        c = f - 'a';
+        r = 8 - (R - '0');
+        return true;
+    }
+
+    U64 attackersTo(int sq, U64 occ) const {
+        return (pawnAttacks[BLACK][sq] & pieces[WP])
+             | (pawnAttacks[WHITE][sq] & pieces[BP])
+             | (knightAttacks[sq] & (pieces[WN] | pieces[BN]))
+             | (kingAttacks[sq] & (pieces[WK] | pieces[BK]))
+             | (bishopAttacks(sq, occ) & (pieces[WB] | pieces[BB] | pieces[WQ] | pieces[BQ]))
+             | (rookAttacks(sq, occ) & (pieces[WR] | pieces[BR] | pieces[WQ] | pieces[BQ]));
+    }
+    bool squareAttacked(int sq, int byColorIdx) const {
+        return attackersTo(sq, occupied) & byColor[byColorIdx];
+    }
+    bool isAttacked(int tr,int tc,bool attackerIsWhite) const {
+        return squareAttacked(toSquare(tr,tc), attackerIsWhite ? WHITE : BLACK);
+    }
+    int kingSquare(int color) const { return lsb(pieces[makePiece(color, KING)]); }
+    bool findKing(bool white, int &kr,int &kc) const {
+        U64 k = pieces[white ? WK : BK];
+        if (!k) return false;
+        kr = rowOf(lsb(k)); kc = colOf(lsb(k));
+        return true;
+    }
+    bool inCheck() const {
+        int us = whiteToMove ? WHITE : BLACK;
+        return squareAttacked(kingSquare(us), us ^ 1);
+    }
+
+    // Every square attacked by `color`, with the given occupancy. Used for
+    // king danger, where our own king is removed so it cannot hide behind itself.
+    U64 attackedBy(int color, U64 occ) const {
+        U64 pawns = pieces[makePiece(color, PAWN)];
+        U64 att = color == WHITE ? ((pawns << 7) & ~0x8080808080808080ULL) | ((pawns << 9) & ~0x0101010101010101ULL)
+                                 : ((pawns >> 9) & ~0x8080808080808080ULL) | ((pawns >> 7) & ~0x0101010101010101ULL);
+        for (U64 b = pieces[makePiece(color, KNIGHT)]; b; ) att |= knightAttacks[popLsb(b)];
+        for (U64 b = pieces[makePiece(color, BISHOP)] | pieces[makePiece(color, QUEEN)]; b; ) att |= bishopAttacks(popLsb(b), occ);
+        for (U64 b = pieces[makePiece(color, ROOK)] | pieces[makePiece(color, QUEEN)]; b; ) att |= rookAttacks(popLsb(b), occ);
+        att |= kingAttacks[kingSquare(color)];
+        return att;
+    }
+
+    // Strictly legal generation: checkers and pins are computed once, then
+    // each piece is restricted to the check mask and its pin line, so no
+    // move ever has to be tried and taken back.
+    void addNormal(MoveList &list, int from, int to) const {
+        list.add(from, to, squares[to] != NO_PIECE ? Move::CAPTURE : Move::QUIET);
+    }
+
+    void generateLegal(MoveList &list) const {
+        list.size = 0;
+        int us = whiteToMove ? WHITE : BLACK, them = us ^ 1;
+        U64 own = byColor[us], enemy = byColor[them];
+        int k = kingSquare(us);
+        U64 danger = attackedBy(them, occupied ^ bit(k));
+        for (U64 t = kingAttacks[k] & ~own & ~danger; t; ) addNormal(list, k, popLsb(t));
+
+        U64 checkers = attackersTo(k, occupied) & enemy;
+        if (popcount(checkers) > 1) return;
+        U64 checkMask = checkers ? (checkers | betweenBB[k][lsb(checkers)]) : ~0ULL;
+
+        U64 pinned = 0;
+        U64 theirRQ = pieces[makePiece(them, ROOK)] | pieces[makePiece(them, QUEEN)];
+        U64 theirBQ = pieces[makePiece(them, BISHOP)] | pieces[makePiece(them, QUEEN)];
+        U64 snipers = (rookAttacks(k, enemy) & theirRQ) | (bishopAttacks(k, enemy) & theirBQ);
+        while (snipers) {
+            U64 blockers = betweenBB[k][popLsb(snipers)] & occupied;
+            if (popcount(blockers) == 1) pinned |= blockers & own;
+        }
+        auto allowed = [&](int from) { return (pinned & bit(from)) ? lineBB[k][from] : ~0ULL; };
+
+        U64 pawns = pieces[makePiece(us, PAWN)];
+        int up = us == WHITE ? 8 : -8;
+        U64 promoRank = us == WHITE ? 0xFF00000000000000ULL : 0xFFULL;
+        U64 thirdRank = us == WHITE ? 0xFF0000ULL : 0xFF0000000000ULL;
+        auto addPawn = [&](int from, int to) {
+            int capture = squares[to] != NO_PIECE ? Move::CAPTURE : 0;
+            if (bit(to) & promoRank) {
+                for (int pt = QUEEN; pt >= KNIGHT; --pt) list.add(from, to, Move::PROMO | capture | (pt - KNIGHT));
+            } else list.add(from, to, capture);
+        };
+        for (U64 b = pawns; b; ) {
+            int from = popLsb(b);
+            U64 mask = checkMask & allowed(from);
+            int one = from + up;
+            if (!(occupied & bit(one))) {
+                if (mask & bit(one)) addPawn(from, one);
+                if ((bit(one) & thirdRank) && !(occupied & bit(one + up)) && (mask & bit(one + up)))
+                    list.add(from, one + up, Move::DOUBLE_PUSH);
+            }
+            for (U64 t = pawnAttacks[us][from] & enemy & mask; t; ) addPawn(from, popLsb(t));
+            if (epSquare >= 0 && (pawnAttacks[us][from] & bit(epSquare))) {
+                int victim = epSquare - up;
+                if (!((checkMask & bit(victim)) || (checkMask & bit(epSquare)))) continue;
+                // Lifting both pawns can expose the king along a rank or diagonal.
+                U64 occ = (occupied ^ bit(from) ^ bit(victim)) | bit(epSquare);
+                if ((rookAttacks(k, occ) & theirRQ) || (bishopAttacks(k, occ) & theirBQ)) continue;
+                list.add(from, epSquare, Move::EP_CAPTURE);
+            }
+        }
+        for (int type = KNIGHT; type <= QUEEN; ++type) {
+            for (U64 b = pieces[makePiece(us, type)]; b; ) {
+                int from = popLsb(b);
+                U64 att = type == KNIGHT ? knightAttacks[from]
+                        : type == BISHOP ? bishopAttacks(from, occupied)
+                        : type == ROOK   ? rookAttacks(from, occupied)
+                        : queenAttacks(from, occupied);
+                for (U64 t = att & ~own & checkMask & allowed(from); t; ) addNormal(list, from, popLsb(t));
+            }
+        }
+        if (castling && !checkers) {
+            int oo = us == WHITE ? WHITE_OO : BLACK_OO, ooo = us == WHITE ? WHITE_OOO : BLACK_OOO;
+            if ((castling & oo) && !(occupied & (bit(k+1) | bit(k+2))) && !(danger & (bit(k+1) | bit(k+2))))
+                list.add(k, k+2, Move::KING_CASTLE);
+            if ((castling & ooo) && !(occupied & (bit(k-1) | bit(k-2) | bit(k-3))) && !(danger & (bit(k-1) | bit(k-2))))
+                list.add(k, k-2, Move::QUEEN_CASTLE);
+        }
+    }
+
+    static int castleMask(int sq) {
+        switch (sq) {
+            case 0:  return ~WHITE_OOO;
+            case 4:  return ~(WHITE_OO | WHITE_OOO);
+            case 7:  return ~WHITE_OO;
+            case 56: return ~BLACK_OOO;
+            case 60: return ~(BLACK_OO | BLACK_OOO);
+            case 63: return ~BLACK_OO;
+            default: return ~0;
+        }
+    }
+
+    // Plays a legal move in place and records what unmake() needs.
+    void make(Move m) {
+        int us = whiteToMove ? WHITE : BLACK;
+        int from = m.from(), to = m.to(), flags = m.flags();
+        Undo &u = history[plies & (HISTORY_CAP-1)];
+        u.key = key;
+        u.move = m;
+        u.captured = NO_PIECE;
+        u.castling = (std::uint8_t)castling;
+        u.epSquare = (std::int8_t)epSquare;
+        u.halfmoves = (std::uint16_t)halfmoves;
+        ++plies;
+        if (undoable < HISTORY_CAP) ++undoable;
+        redoable = 0;
+
+        key ^= epKey() ^ castlingKey(castling);
+        int type = typeOf(squares[from]);
+        if (flags == Move::EP_CAPTURE) {
+            int victim = to + (us == WHITE ? -8 : 8);
+            u.captured = squares[victim];
+            removePiece(victim);
+        } else if (m.isCapture()) {
+            u.captured = squares[to];
+            removePiece(to);
+        }
+        movePiece(from, to);
+        if (m.isPromotion()) {
+            removePiece(to);
+            putPiece(makePiece(us, m.promoType()), to);
+        } else if (flags == Move::KING_CASTLE) {
+            movePiece(to+1, to-1);
+        } else if (flags == Move::QUEEN_CASTLE) {
+            movePiece(to-2, to+1);
+        }
+        epSquare = flags == Move::DOUBLE_PUSH ? (from + to) / 2 : -1;
+        castling &= castleMask(from) & castleMask(to);
+        halfmoves = (type == PAWN || m.isCapture()) ? 0 : halfmoves + 1;
+        whiteToMove = !whiteToMove;
+        if (whiteToMove) ++fullmoves;
+        key ^= zobrist[ZOBRIST_TURN] ^ castlingKey(castling) ^ epKey();
+    }
+
+    // Takes back the last make(). The caller must check canUndo() first
+    // when the ring may have wrapped.
+    void unmake() {
+        --plies;
+        --undoable;
+        ++redoable;
+        const Undo &u = history[plies & (HISTORY_CAP-1)];
+        Move m = u.move;
+        whiteToMove = !whiteToMove;
+        if (!whiteToMove) --fullmoves;
+        int us = whiteToMove ? WHITE : BLACK;
+        int from = m.from(), to = m.to(), flags = m.flags();
+        if (m.isPromotion()) {
+            removePiece(to);
+            putPiece(makePiece(us, PAWN), to);
+        } else if (flags == Move::KING_CASTLE) {
+            movePiece(to-1, to+1);
+        } else if (flags == Move::QUEEN_CASTLE) {
+            movePiece(to+1, to-2);
+        }
+        movePiece(to, from);
+        if (flags == Move::EP_CAPTURE) putPiece(u.captured, to + (us == WHITE ? -8 : 8));
+        else if (u.captured != NO_PIECE) putPiece(u.captured, to);
+        castling = u.castling;
+        epSquare = u.epSquare;
+        halfmoves = u.halfmoves;
+        key = u.key;
+    }
+
+    // Finds the legal move matching a from/to square pair. A missing or
+    // unknown promotion letter means a queen.
+    bool findMove(int sr,int sc,int tr,int tc, char promo, Move &out) const {
+        if (!inBounds(sr,sc) || !inBounds(tr,tc)) return false;
+        promo = (char)std::tolower((unsigned char)promo);
+        if (promo!='q' && promo!='r' && promo!='b' && promo!='n') promo = 'q';
+        int from = toSquare(sr,sc), to = toSquare(tr,tc);
+        MoveList list;
+        generateLegal(list);
+        for (int i=0; i<list.size; ++i) {
+            Move m = list.moves[i];
+            if (m.from()!=from || m.to()!=to || (m.isPromotion() && m.promo()!=promo)) continue;
+            out = m;
+            return true;
+        }
+        return false;
+    }
+
+    // Finds the legal move written in UCI notation (e2e4, e7e8q).
+    bool findUci(const std::string &s, Move &out) const {
+        MoveList list;
+        generateLegal(list);
+        for (int i=0; i<list.size; ++i)
+            if (list.moves[i].uci() == s) { out = list.moves[i]; return true; }
+        return false;
+    }
+
+    bool makeMoveIfLegal(int sr,int sc,int tr,int tc, char promo = 0) {
+        Move m;
+        if (!findMove(sr,sc,tr,tc,promo,m)) return false;
+        make(m);
+        return true;
+    }
+
+    std::vector<Move> legalMoves() const {
+        MoveList list;
+        generateLegal(list);
+        return std::vector<Move>(list.moves, list.moves + list.size);
+    }
+};
+static_assert(sizeof(Game::Move) == 2, "Game::Move must stay 16 bits");
+
+// ------------------------------------------------------
+// Perft
+// ------------------------------------------------------
+// Shared subtree-count cache. Each slot holds (key ^ data, data) so a torn
+// write from another thread just reads as a miss instead of a wrong count.
+struct PerftTable {
+    struct Entry { std::atomic<U64> check{0}, data{0}; };
+    std::unique_ptr<Entry[]> entries;
+    U64 mask = 0;
+
+    explicit PerftTable(int megabytes) {
+        U64 n = 1;
+        while (n * 2 * sizeof(Entry) <= (U64)megabytes << 20) n *= 2;
+        entries.reset(new Entry[n]);
+        mask = n - 1;
+    }
+    bool probe(U64 key, int depth, U64 &count) const {
+        const Entry &e = entries[key & mask];
+        U64 data = e.data.load(std::memory_order_relaxed);
+        if ((e.check.load(std::memory_order_relaxed) ^ data) != key || (int)(data & 0xFF) != depth) return false;
+        count = data >> 8;
+        return true;
+    }
+    void store(U64 key, int depth, U64 count) {
+        Entry &e = entries[key & mask];
+        U64 data = (count << 8) | (U64)depth;
+        e.check.store(key ^ data, std::memory_order_relaxed);
+        e.data.store(data, std::memory_order_relaxed);
+    }
+};
+
+static U64 perft(Game &g, int depth, PerftTable *tt) {
+    Game::MoveList list;
+    g.generateLegal(list);
+    if (depth <= 1) return depth == 1 ? (U64)list.size : 1;
+    U64 key = 0, nodes = 0;
+    if (tt) {
+        key = g.key;
+        if (tt->probe(key, depth, nodes)) return nodes;
+    }
+    for (int i=0; i<list.size; ++i) {
+        g.make(list.moves[i]);
+        nodes += perft(g, depth - 1, tt);
+        g.unmake();
+    }
+    if (tt) tt->store(key, depth, nodes);
+    return nodes;
+}
+
+// Splits the root moves across `threads` workers pulling from a shared
+// counter, so uneven subtrees still balance out. Fills one count per root move.
+static U64 perftRoot(const Game &root, int depth, int threads, PerftTable *tt, Game::MoveList &moves, std::vector<U64> &counts) {
+    root.generateLegal(moves);
+    counts.assign(moves.size, 0);
+    if (depth <= 0) return 1;
+    std::atomic<int> next{0};
+    auto worker = [&]() {
+        auto g = std::make_unique<Game>(root);
+        for (int i; (i = next++) < moves.size; ) {
+            g->make(moves.moves[i]);
+            counts[i] = perft(*g, depth - 1, tt);
+            g->unmake();
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t=1; t<threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto &th : pool) th.join();
+    U64 total = 0;
+    for (U64 c : counts) total += c;
+    return total;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void printNodeRate(U64 nodes, double secs) {
+    std::cout << nodes << " nodes in " << secs << " s ("
+              << (U64)(nodes / std::max(secs, 1e-9)) << " nps)\n";
+}
+
+struct PerftCase { const char *name; const char *fen; int depth; U64 nodes; };
+static const PerftCase perftSuite[] = {
+    {"start",      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 6, 119060324},
+    {"kiwipete",   "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 5, 193690690},
+    {"position3",  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 6, 11030083},
+    {"position4",  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 5, 15833292},
+    {"position4m", "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1", 5, 15833292},
+    {"position5",  "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487},
+    {"position6",  "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594},
+    {"ep-pin",     "8/8/1k6/2b5/2pP4/8/5K2/8 b - d3 0 1", 6, 1440467},
+    {"ep-discover","3k4/3p4/8/K1P4r/8/8/8/8 b - - 0 1", 6, 1134888},
+    {"castle-rook","r3k2r/1b4bq/8/8/8/8/7B/R3K2R w KQkq - 0 1", 4, 1274206},
+    {"castle-long","r3k2r/8/3Q4/8/8/5q2/8/R3K2R b KQkq - 0 1", 4, 1720476},
+    {"short-only", "5k2/8/8/8/8/8/8/4K2R w K - 0 1", 6, 661072},
+    {"long-only",  "3k4/8/8/8/8/8/8/R3K3 w Q - 0 1", 6, 803711},
+    {"promo-check","2K2r2/4P3/8/8/8/8/8/3k4 w - - 0 1", 6, 3821001},
+    {"underpromo", "4k3/1P6/8/8/8/8/K7/8 w - - 0 1", 6, 217342},
+    {"promo-stale","8/P1k5/K7/8/8/8/8/8 w - - 0 1", 6, 92683},
+    {"self-stale", "K1k5/8/P7/8/8/8/8/8 w - - 0 1", 6, 2217},
+    {"stale-mate", "8/k1P5/8/1K6/8/8/8/8 w - - 0 1", 7, 567584},
+    {"double-chk", "8/8/2k5/5q2/5n2/8/5K2/8 b - - 0 1", 4, 23527},
+};
+
+static int runPerftSuite(int threads, PerftTable *tt) {
+    int failed = 0;
+    U64 totalNodes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const PerftCase &c : perftSuite) {
+        Game g;
+        g.setFen(c.fen);
+        Game::MoveList moves;
+        std::vector<U64> counts;
+        auto t0 = std::chrono::steady_clock::now();
+        U64 nodes = perftRoot(g, c.depth, threads, tt, moves, counts);
+        double secs = secondsSince(t0);
+        bool ok = nodes == c.nodes;
+        if (!ok) ++failed;
+        totalNodes += nodes;
+        std::cout << (ok ? "ok   " : "FAIL ") << c.name << " depth " << c.depth << ": ";
+        if (!ok) std::cout << "expected " << c.nodes << ", got ";
+        printNodeRate(nodes, secs);
+    }
+    std::cout << "suite: " << (sizeof(perftSuite)/sizeof(perftSuite[0]) - failed) << "/"
+              << sizeof(perftSuite)/sizeof(perftSuite[0]) << " passed, ";
+    printNodeRate(totalNodes, secondsSince(start));
+    return failed ? 1 : 0;
+}
+
+// ------------------------------------------------------
+// Evaluation
+// ------------------------------------------------------
+static inline int squareDistance(int a, int b) {
+    return std::max(std::abs((a & 7) - (b & 7)), std::abs((a >> 3) - (b >> 3)));
+}
+
+// Against a bare king, rewards pushing it to the edge (to a corner of the
+// bishop's colour with bishop and knight) and bringing our king closer.
+// Without it the search cannot see progress in won endings.
+static int mopUp(const Game &g, int strong) {
+    int k = g.kingSquare(strong), lone = g.kingSquare(strong ^ 1);
+    int edge = std::max(3 - (lone & 7), (lone & 7) - 4) + std::max(3 - (lone >> 3), (lone >> 3) - 4);
+    U64 bishops = g.pieces[makePiece(strong, BISHOP)];
+    if (bishops && g.pieces[makePiece(strong, KNIGHT)] && popcount(g.byColor[strong]) == 3) {
+        const U64 dark = 0xAA55AA55AA55AA55ULL;
+        edge = (bishops & dark) ? 7 - std::min(squareDistance(lone, 0), squareDistance(lone, 63))
+                                : 7 - std::min(squareDistance(lone, 7), squareDistance(lone, 56));
+    }
+    return 20 * edge + 10 * (7 - squareDistance(k, lone));
+}
+
+// Score from the side to move's point of view, read off the accumulator.
+static int evaluate(const Game &g) {
+    int us = g.whiteToMove ? WHITE : BLACK;
+    const std::int16_t *a = g.acc[us];
+    const EvalNet &net = *g.net;
+    int score;
+    if (net.pst) {
+        int phase = std::min((int)a[2], 24);
+        score = (a[0] * phase + a[1] * (24 - phase)) / 24;
+    } else {
+        std::int32_t sum = dotClippedRelu(a, net.outputWeights.data(), net.hidden)
+                         + dotClippedRelu(g.acc[us ^ 1], net.outputWeights.data() + net.hidden, net.hidden)
+                         + net.outputBias;
+        score = sum * 400 / (255 * 64);
+    }
+    for (int c=0; c<2; ++c) {
+        U64 heavy = g.byColor[c] & ~g.pieces[makePiece(c, PAWN)] & ~g.pieces[makePiece(c, KING)];
+        if (popcount(g.byColor[c ^ 1]) == 1 && heavy) score += c == us ? mopUp(g, c) : -mopUp(g, c);
+    }
+    return score;
+}
+
+// ------------------------------------------------------
+// Endgame bitbases
+// ------------------------------------------------------
+// KQK, KRK, KPK and KBNK hold one bit per position: set when the side with
+// the extra material wins. A bare king can never win, so the bit and the
+// side to move give win/draw/loss. Positions are stored with the strong
+// side as White and its king folded into the a1-d1-d4 triangle (files a-d
+// when there is a pawn). A file is an 8-byte magic followed by the
+// white-to-move and black-to-move bit arrays as native 64-bit words.
+struct BitbaseSpec { const char *name; int types[2]; int count; };
+enum { BB_KQK, BB_KRK, BB_KPK, BB_KBNK, BITBASE_COUNT };
+// KPK comes after KQK and KRK because promotions look into them. Pieces are
+// listed in PieceType order, which is how probes collect them.
+static const BitbaseSpec bitbaseSpecs[BITBASE_COUNT] = {
+    {"kqk", {QUEEN, 0}, 1}, {"krk", {ROOK, 0}, 1}, {"kpk", {PAWN, 0}, 1}, {"kbnk", {KNIGHT, BISHOP}, 2},
+};
+static const char bitbaseMagic[8] = {'A', 'S', 'Y', 'S', 'B', 'B', '0', '1'};
+static int triangleSlot[64], triangleSquare[10];
+
+static bool initBitbaseIndex() {
+    int n = 0;
+    for (int sq=0; sq<64; ++sq) {
+        int f = sq & 7, r = sq >> 3;
+        triangleSlot[sq] = -1;
+        if (f <= 3 && r <= f) { triangleSlot[sq] = n; triangleSquare[n++] = sq; }
+    }
+    return true;
+}
+static const bool bitbaseIndexReady = initBitbaseIndex();
+
+// sq[0] is the strong king, sq[1] the bare king, then the spec's pieces.
+struct Bitbase {
+    int spec = -1;
+    bool pawn = false;
+    U64 size = 0;                     // positions per side to move
+    const U64 *bits = nullptr;        // white to move, then black to move
+    MappedFile file;
+    std::vector<U64> owned;           // set while generating
+
+    void setSpec(int s) {
+        spec = s;
+        pawn = bitbaseSpecs[s].types[0] == PAWN;
+        size = (pawn ? 32 : 10) * 64;
+        for (int i=0; i<bitbaseSpecs[s].count; ++i) size *= pawn ? 48 : 64;
+    }
+    U64 words() const { return (size + 63) / 64; }
+    int pieceCount() const { return 2 + bitbaseSpecs[spec].count; }
+
+    // Maps the squares onto the canonical half or triangle and indexes them.
+    U64 index(const int *in) const {
+        int sq[4], n = pieceCount();
+        std::copy(in, in + n, sq);
+        if ((sq[0] & 7) > 3) for (int i=0; i<n; ++i) sq[i] ^= 7;
+        if (!pawn) {
+            if ((sq[0] >> 3) > 3) for (int i=0; i<n; ++i) sq[i] ^= 56;
+            if ((sq[0] >> 3) > (sq[0] & 7)) for (int i=0; i<n; ++i) sq[i] = (sq[i] >> 3) | ((sq[i] & 7) << 3);
+        }
+        U64 idx = pawn ? (sq[0] >> 3) * 4 + (sq[0] & 7) : triangleSlot[sq[0]];
+        idx = idx * 64 + sq[1];
+        for (int i=2; i<n; ++i) idx = pawn ? idx * 48 + sq[i] - 8 : idx * 64 + sq[i];
+        return idx;
+    }
+    void decode(U64 idx, int *sq) const {
+        for (int i=pieceCount()-1; i>=2; --i) {
+            if (pawn) { sq[i] = (int)(idx % 48) + 8; idx /= 48; }
+            else { sq[i] = (int)(idx % 64); idx /= 64; }
+        }
+        sq[1] = (int)(idx % 64);
+        idx /= 64;
+        sq[0] = pawn ? (int)(idx / 4) * 8 + (int)(idx % 4) : triangleSquare[idx];
+    }
+    bool get(int stm, U64 idx) const { return (bits[stm * words() + idx / 64] >> (idx % 64)) & 1; }
+    bool wins(int stm, const int *sq) const { return get(stm, index(sq)); }
+
+    bool open(const std::string &path, int s) {
+        setSpec(s);
+        if (!file.open(path) || file.size != 8 + 2 * words() * 8
+            || std::memcmp(file.data, bitbaseMagic, 8) != 0) { file.close(); bits = nullptr; return false; }
+        bits = (const U64 *)(file.data + 8);
+        return true;
+    }
+};
+
+struct Bitbases {
+    Bitbase tables[BITBASE_COUNT];
+    int loaded = 0;
+
+    int load(const std::string &dir) {
+        loaded = 0;
+        for (int i=0; i<BITBASE_COUNT; ++i)
+            loaded += tables[i].open(dir + "/" + bitbaseSpecs[i].name + ".bb", i);
+        return loaded;
+    }
+
+    // wdl is +1/0/-1 for the side to move. False when no table covers the
+    // material.
+    bool probe(const Game &g, int &wdl) const {
+        if (!loaded || popcount(g.occupied) > 4) return false;
+        int strong = popcount(g.byColor[WHITE]) > 1 ? WHITE : BLACK;
+        if (popcount(g.byColor[strong ^ 1]) != 1) return false;
+        int sq[4], n = 2, flip = strong == WHITE ? 0 : 56;
+        sq[0] = g.kingSquare(strong) ^ flip;
+        sq[1] = g.kingSquare(strong ^ 1) ^ flip;
+        for (int t=PAWN; t<KING; ++t) {
+            U64 b = g.pieces[makePiece(strong, t)];
+            while (b) {
+                if (n == 4) return false;
+                sq[n++] = popLsb(b) ^ flip;
+            }
+        }
+        for (const Bitbase &t : tables) {
+            if (!t.bits || bitbaseSpecs[t.spec].count != n - 2) continue;
+            const BitbaseSpec &s = bitbaseSpecs[t.spec];
+            bool match = true;
+            for (int i=0; i<s.count; ++i) match &= g.squares[sq[2+i] ^ flip] == makePiece(strong, s.types[i]);
+            if (!match) continue;
+            int stm = (g.whiteToMove ? WHITE : BLACK) == strong ? 0 : 1;
+            wdl = !t.wins(stm, sq) ? 0 : stm == 0 ? 1 : -1;
+            return true;
+        }
+        return false;
+    }
+};
+
+static Bitbases bitbases;
+
+static U64 pieceAttacks(int type, int sq, U64 occ) {
+    switch (type) {
+    case PAWN: return pawnAttacks[WHITE][sq];
+    case KNIGHT: return knightAttacks[sq];
+    case BISHOP: return bishopAttacks(sq, occ);
+    case ROOK: return rookAttacks(sq, occ);
+    case QUEEN: return queenAttacks(sq, occ);
+    default: return kingAttacks[sq];
+    }
+}
+
+// Retrograde solver by repeated sweeps: a white-to-move position wins if
+// some move reaches a won black-to-move position, a black-to-move position
+// if it is mate or every move reaches a won one. Sweeps repeat until
+// nothing changes. Threads take 4096-position chunks of each sweep and
+// publish bits with atomic ORs, so a sweep can already use bits set
+// earlier in the same sweep.
+static void generateBitbase(Bitbase &bb, const Bitbase *tables, int threads, int &sweeps, U64 &wins) {
+    const BitbaseSpec &spec = bitbaseSpecs[bb.spec];
+    const int n = bb.pieceCount();
+    const U64 words = bb.words();
+    std::vector<std::atomic<U64>> win(2 * words), done(2 * words);
+    for (U64 i=0; i<2*words; ++i) { win[i] = 0; done[i] = 0; }
+    auto test = [&](int stm, U64 idx) { return (win[stm * words + idx / 64].load(std::memory_order_relaxed) >> (idx % 64)) & 1; };
+    auto mark = [](std::atomic<U64> &w, U64 idx) { w.fetch_or(1ULL << (idx % 64), std::memory_order_relaxed); };
+
+    // Returns 1 for a win, 0 for undecided and -1 for a final non-win
+    // (illegal, stalemate, or the bare king can take something).
+    auto solve = [&](int stm, U64 idx) -> int {
+        int sq[4];
+        bb.decode(idx, sq);
+        U64 occ = 0;
+        for (int i=0; i<n; ++i) {
+            if (occ & bit(sq[i])) return -1;
+            occ |= bit(sq[i]);
+        }
+        int wk = sq[0], bk = sq[1];
+        if (kingAttacks[wk] & bit(bk)) return -1;
+        U64 pieceAtt = 0;
+        for (int i=2; i<n; ++i) pieceAtt |= pieceAttacks(spec.types[i-2], sq[i], occ);
+        if (stm == 0) {
+            if (pieceAtt & bit(bk)) return -1;
+            int child[4];
+            std::copy(sq, sq + n, child);
+            for (U64 b = kingAttacks[wk] & ~occ & ~kingAttacks[bk]; b; ) {
+                child[0] = popLsb(b);
+                if (test(1, bb.index(child))) return 1;
+            }
+            child[0] = wk;
+            for (int i=2; i<n; ++i) {
+                int from = sq[i], type = spec.types[i-2];
+                U64 targets = type == PAWN ? bit(from + 8) & ~occ : pieceAttacks(type, from, occ) & ~occ;
+                if (type == PAWN && (from >> 3) == 1 && targets && !(occ & bit(from + 16))) targets |= bit(from + 16);
+                for (U64 b = targets; b; ) {
+                    int to = popLsb(b);
+                    if (type == PAWN && to >= 56) {
+                        int promo[3] = {wk, bk, to};
+                        if (tables[BB_KQK].wins(1, promo) || tables[BB_KRK].wins(1, promo)) return 1;
+                        continue;
+                    }
+                    child[i] = to;
+                    if (test(1, bb.index(child))) return 1;
+                }
+                child[i] = from;
+            }
+            return 0;
+        }
+        U64 kingOcc = occ ^ bit(bk);
+        U64 guarded = kingAttacks[wk];
+        for (int i=2; i<n; ++i) guarded |= pieceAttacks(spec.types[i-2], sq[i], kingOcc);
+        int child[4], legal = 0;
+        std::copy(sq, sq + n, child);
+        for (U64 b = kingAttacks[bk] & ~guarded; b; ) {
+            int to = popLsb(b);
+            if (occ & bit(to)) return -1;  // takes an undefended piece
+            ++legal;
+            child[1] = to;
+            if (!test(0, bb.index(child))) return 0;
+        }
+        if (legal) return 1;
+        return (pieceAtt & bit(bk)) ? 1 : -1;
+    };
+
+    sweeps = 0;
+    const U64 chunk = 4096;
+    for (bool changed = true; changed; ++sweeps) {
+        std::atomic<bool> any{false};
+        for (int stm=0; stm<2; ++stm) {
+            std::atomic<U64> next{0};
+            auto worker = [&]() {
+                for (U64 lo; (lo = next.fetch_add(chunk)) < bb.size; ) {
+                    for (U64 idx=lo; idx<std::min(lo + chunk, bb.size); ++idx) {
+                        U64 w = stm * words + idx / 64;
+                        if ((done[w].load(std::memory_order_relaxed) >> (idx % 64)) & 1) continue;
+                        int r = solve(stm, idx);
+                        if (r == 0) continue;
+                        mark(done[w], idx);
+                        if (r > 0) { mark(win[w], idx); any = true; }
+                    }
+                }
+            };
+            std::vector<std::thread> pool;
+            for (int t=1; t<threads; ++t) pool.emplace_back(worker);
+            worker();
+            for (auto &th : pool) th.join();
+        }
+        changed = any;
+    }
+    bb.owned.resize(2 * words);
+    wins = 0;
+    for (U64 i=0; i<2*words; ++i) wins += popcount(bb.owned[i] = win[i]);
+    bb.bits = bb.owned.data();
+}
+
+// Random legal placements for one table, for timing probes.
+static std::vector<Game> randomBitbasePositions(int spec, int count) {
+    std::mt19937 rng(2024);
+    std::vector<Game> out;
+    while ((int)out.size() < count) {
+        const BitbaseSpec &s = bitbaseSpecs[spec];
+        Game g;
+        g.clearBoard();
+        int strong = rng() & 1;
+        int kinds[4] = {makePiece(strong, KING), makePiece(strong ^ 1, KING)};
+        for (int i=0; i<s.count; ++i) kinds[2+i] = makePiece(strong, s.types[i]);
+        for (int i=0; i<2+s.count; ++i) {
+            int sq;
+            do sq = rng() % 64;
+            while (g.squares[sq] != NO_PIECE || (typeOf(kinds[i]) == PAWN && (sq < 8 || sq >= 56)));
+            g.putPiece(kinds[i], sq);
+        }
+        g.whiteToMove = rng() & 1;
+        g.castling = 0;
+        g.epSquare = -1;
+        g.key = g.computeKey();
+        int us = g.whiteToMove ? WHITE : BLACK;
+        if (!(kingAttacks[g.kingSquare(WHITE)] & bit(g.kingSquare(BLACK))) && !g.squareAttacked(g.kingSquare(us ^ 1), us))
+            out.push_back(g);
+    }
+    return out;
+}
+
+static double bitbaseProbeMicros(const std::vector<Game> &positions, int rounds) {
+    auto t0 = std::chrono::steady_clock::now();
+    int sink = 0, wdl = 0;
+    for (int r=0; r<rounds; ++r)
+        for (const Game &g : positions) sink += bitbases.probe(g, wdl) + wdl;
+    double us = secondsSince(t0) * 1e6 / ((double)rounds * positions.size());
+    return sink == -1 ? 0 : us;
+}
+
+// Builds every table into dir, then maps them back and times probes.
+static int runBitbaseGen(const std::string &dir, int threads) {
+    Bitbase tables[BITBASE_COUNT];
+    double totalSecs = 0;
+    U64 totalBytes = 0;
+    for (int i=0; i<BITBASE_COUNT; ++i) {
+        Bitbase &bb = tables[i];
+        bb.setSpec(i);
+        int sweeps = 0;
+        U64 wins = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        generateBitbase(bb, tables, threads, sweeps, wins);
+        double secs = secondsSince(t0);
+        std::string path = dir + "/" + bitbaseSpecs[i].name + ".bb";
+        FILE *f = std::fopen(path.c_str(), "wb");
+        if (!f) { std::cerr << "Could not write " << path << "\n"; return 1; }
+        bool ok = std::fwrite(bitbaseMagic, 1, 8, f) == 8
+               && std::fwrite(bb.owned.data(), 8, bb.owned.size(), f) == bb.owned.size();
+        ok &= std::fclose(f) == 0;
+        if (!ok) { std::cerr << "Could not write " << path << "\n"; return 1; }
+        U64 bytes = 8 + bb.owned.size() * 8;
+        totalSecs += secs;
+        totalBytes += bytes;
+        std::cout << bitbaseSpecs[i].name << ": " << 2 * bb.size << " positions, " << wins << " wins, "
+                  << sweeps << " sweeps, " << secs << " s, " << bytes << " bytes\n";
+    }
+    std::cout << "Generated in " << totalSecs << " s with " << threads << " threads, "
+              << totalBytes << " bytes on disk\n";
+    if (bitbases.load(dir) != BITBASE_COUNT) { std::cerr << "Could not map the tables back\n"; return 1; }
+    for (int i=0; i<BITBASE_COUNT; ++i)
+        std::cout << bitbaseSpecs[i].name << " probe: " << bitbaseProbeMicros(randomBitbasePositions(i, 256), 1024) << " us\n";
+    return 0;
+}
+
+static int runBitbaseProbe(const std::string &dir, const std::string &fen) {
+    if (!bitbases.loaded && !bitbases.load(dir)) { std::cerr << "No bitbases in " << dir << "\n"; return 1; }
+    Game g;
+    if (!g.setFen(fen)) { std::cerr << "Bad FEN: " << fen << "\n"; return 1; }
+    int wdl;
+    if (!bitbases.probe(g, wdl)) { std::cout << "No table for this material\n"; return 0; }
+    static const char *names[3] = {"loss", "draw", "win"};
+    std::cout << names[wdl + 1] << " for " << (g.whiteToMove ? "White" : "Black")
+              << ", probe " << bitbaseProbeMicros(std::vector<Game>(1, g), 1000000) << " us\n";
+    return 0;
+}
+
+// ------------------------------------------------------
+// Search
+// ------------------------------------------------------
+enum { INF_SCORE = 32000, MATE_SCORE = 31000, MATE_BOUND = MATE_SCORE - 256, MAX_PLY = 128,
+       KNOWN_WIN = MATE_BOUND - 1000 };
+
+// Shared transposition table. A bucket is four 16-byte slots on one cache
+// line. Each slot stores (key ^ data, data), so a slot half-written by
+// another thread fails the key check and reads as a miss; no locks needed.
+struct TranspositionTable {
+    enum Bound { BOUND_NONE, BOUND_UPPER, BOUND_LOWER, BOUND_EXACT };
+    struct Slot { std::atomic<U64> check{0}, data{0}; };
+    struct alignas(64) Bucket { Slot slots[4]; };
+    struct Entry { Game::Move move; int score = 0, depth = 0, bound = BOUND_NONE; };
+
+    std::unique_ptr<Bucket[]> buckets;
+    U64 mask = 0;
+    unsigned generation = 0;
+
+    explicit TranspositionTable(int megabytes) { resize(megabytes); }
+
+    void resize(int megabytes) {
+        U64 n = 1;
+        while (n * 2 * sizeof(Bucket) <= (U64)std::max(megabytes, 1) << 20) n *= 2;
+        buckets.reset(new Bucket[n]);
+        mask = n - 1;
+    }
+    void clear() {
+        for (U64 i=0; i<=mask; ++i)
+            for (Slot &sl : buckets[i].slots) { sl.check = 0; sl.data = 0; }
+    }
+    void newSearch() { generation = (generation + 1) & 63; }
+
+    // data layout: move 16 | score 16 | depth 8 | bound 2 | generation 6
+    static int slotDepth(U64 data) { return (int)((data >> 32) & 0xFF); }
+    static unsigned slotGeneration(U64 data) { return (unsigned)(data >> 42) & 63; }
+
+    bool probe(U64 key, Entry &e) const {
+        const Bucket &b = buckets[key & mask];
+        for (const Slot &sl : b.slots) {
+            U64 data = sl.data.load(std::memory_order_relaxed);
+            if ((sl.check.load(std::memory_order_relaxed) ^ data) != key) continue;
+            e.move.data = (std::uint16_t)data;
+            e.score = (std::int16_t)(data >> 16);
+            e.depth = slotDepth(data);
+            e.bound = (int)(data >> 40) & 3;
+            return true;
+        }
+        return false;
+    }
+
+    // Replaces the slot holding this key, else the shallowest, oldest one.
+    void store(U64 key, Game::Move move, int score, int depth, int bound) {
+        Bucket &b = buckets[key & mask];
+        Slot *target = &b.slots[0];
+        int worst = INT32_MAX;
+        for (Slot &sl : b.slots) {
+            U64 data = sl.data.load(std::memory_order_relaxed);
+            if ((sl.check.load(std::memory_order_relaxed) ^ data) == key) {
+                if (move.data == 0) move.data = (std::uint16_t)data;
+                target = &sl;
+                break;
+            }
+            int value = slotDepth(data) - 8 * (int)((generation - slotGeneration(data)) & 63);
+            if (value < worst) { worst = value; target = &sl; }
+        }
+        U64 data = (U64)move.data | ((U64)(std::uint16_t)score << 16) | ((U64)std::max(depth, 0) << 32)
+                 | ((U64)bound << 40) | ((U64)generation << 42);
+        target->check.store(key ^ data, std::memory_order_relaxed);
+        target->data.store(data, std::memory_order_relaxed);
+    }
+
+    // Permille of sampled slots written during the current search.
+    int hashfull() const {
+        int used = 0, sampled = 0;
+        for (U64 i=0; i<std::min<U64>(250, mask + 1); ++i)
+            for (const Slot &sl : buckets[i].slots) {
+                ++sampled;
+                U64 data = sl.data.load(std::memory_order_relaxed);
+                if (data && slotGeneration(data) == generation) ++used;
+            }
+        return used * 1000 / std::max(sampled, 1);
+    }
+};
+
+// Mate scores are stored relative to the node, not the root.
+static int scoreToTT(int score, int ply) {
+    return score >= MATE_BOUND ? score + ply : score <= -MATE_BOUND ? score - ply : score;
+}
+static int scoreFromTT(int score, int ply) {
+    return score >= MATE_BOUND ? score - ply : score <= -MATE_BOUND ? score + ply : score;
+}
+
+// Lets another thread stop a running search, or hold its clock while it
+// ponders: the time limit only applies once pondering is cleared, and is
+// still measured from the start of the search.
+struct SearchControl {
+    std::atomic<bool> stop{false};
+    std::atomic<bool> pondering{false};
+};
+
+struct SearchResult;
+
+struct SearchLimits {
+    int timeMs = 1000;        // 0 = no time limit
+    int maxDepth = MAX_PLY - 1;
+    U64 maxNodes = 0;         // 0 = no node limit
+    SearchControl *control = nullptr;
+    std::function<void(const SearchResult &)> onIteration; // main thread, after each depth
+};
+
+struct SearchResult {
+    Game::Move best;
+    int score = 0;
+    int depth = 0;
+    U64 nodes = 0;
+    double secs = 0;
+    std::vector<Game::Move> pv;
+    U64 nps() const { return (U64)(nodes / std::max(secs, 1e-9)); }
+};
+
+// Iterative-deepening PVS with quiescence. Each Searcher owns its copy of
+// the game, so several can run side by side.
+struct Searcher {
+    Game game;
+    SearchLimits limits;
+    TranspositionTable *tt = nullptr;
+    int threadId = 0;         // 0 = main thread, others are Lazy SMP helpers
+    bool rootInBitbase = false;
+    std::atomic<bool> stop{false};
+    U64 nodes = 0;
+    std::chrono::steady_clock::time_point start;
+    Game::Move killers[MAX_PLY][2];
+    int historyScore[12][64];
+    Game::Move pv[MAX_PLY][MAX_PLY];
+    int pvLength[MAX_PLY];
+
+    // The clock, node count and stop flag are set up here rather than in
+    // run(): a helper thread that starts late must not clear a stop that
+    // searchSmp has already raised.
+    Searcher(const Game &g, TranspositionTable *table)
+        : game(g), tt(table), start(std::chrono::steady_clock::now()) {}
+
+    bool pondering() const { return limits.control && limits.control->pondering; }
+
+    void checkTime() {
+        if (limits.control && limits.control->stop) stop = true;
+        else if (limits.timeMs > 0 && !pondering() && secondsSince(start) * 1000 >= limits.timeMs) stop = true;
+        else if (limits.maxNodes && nodes >= limits.maxNodes) stop = true;
+    }
+
+    // Ordering: the hash move, captures by MVV-LVA (promotions first), then
+    // the two killers, then quiet moves by history.
+    void scoreMoves(const Game::MoveList &list, int *scores, int ply, Game::Move ttMove = Game::Move()) const {
+        for (int i=0; i<list.size; ++i) {
+            Game::Move m = list.moves[i];
+            int mover = game.squares[m.from()];
+            if (m == ttMove) scores[i] = 2000000;
+            else if (m.isCapture() || m.isPromotion()) {
+                int victim = m.flags() == Game::Move::EP_CAPTURE ? PAWN
+                           : m.isCapture() ? typeOf(game.squares[m.to()]) : PAWN;
+                scores[i] = 1000000 + (m.isPromotion() ? pieceValue[m.promoType()] * 10 : 0)
+                          + pieceValue[victim] * 10 - typeOf(mover);
+            } else if (m == killers[ply][0]) scores[i] = 900000;
+            else if (m == killers[ply][1]) scores[i] = 800000;
+            else scores[i] = historyScore[mover][m.to()];
+        }
+    }
+
+    static void pickNext(Game::MoveList &list, int *scores, int i) {
+        int best = i;
+        for (int j=i+1; j<list.size; ++j) if (scores[j] > scores[best]) best = j;
+        std::swap(list.moves[i], list.moves[best]);
+        std::swap(scores[i], scores[best]);
+    }
+
+    int quiesce(int alpha, int beta, int ply) {
+        if ((++nodes & 1023) == 0) checkTime();
+        if (stop) return 0;
+        if (ply >= MAX_PLY - 1) return evaluate(game);
+        bool inCheck = game.inCheck();
+        int best = -INF_SCORE;
+        if (!inCheck) {
+            best = evaluate(game);
+            if (best >= beta) return best;
+            if (best > alpha) alpha = best;
+        }
+        Game::MoveList list;
+        game.generateLegal(list);
+        if (list.size == 0) return inCheck ? -MATE_SCORE + ply : 0;
+        int scores[256];
+        scoreMoves(list, scores, ply);
+        for (int i=0; i<list.size; ++i) {
+            pickNext(list, scores, i);
+            Game::Move m = list.moves[i];
+            if (!inCheck && !m.isCapture() && !m.isPromotion()) break;
+            game.make(m);
+            int score = -quiesce(-beta, -alpha, ply + 1);
+            game.unmake();
+            if (stop) return 0;
+            if (score > best) {
+                best = score;
+                if (score > alpha) {
+                    alpha = score;
+                    if (score >= beta) break;
+                }
+            }
+        }
+        return best;
+    }
+
+    int alphaBeta(int depth, int alpha, int beta, int ply) {
+        pvLength[ply] = ply;
+        bool inCheck = game.inCheck();
+        if (inCheck) ++depth;
+        if (depth <= 0) return quiesce(alpha, beta, ply);
+        if ((++nodes & 1023) == 0) checkTime();
+        if (stop) return 0;
+        if (ply > 0) {
+            if (game.halfmoves >= 100 || game.isRepetition()) return 0;
+            if (ply >= MAX_PLY - 1) return evaluate(game);
+            // Entering a table ends the line. Once the root is already in
+            // one, only draws are cut and the search plays the win out.
+            int wdl;
+            if (bitbases.probe(game, wdl) && (wdl == 0 || !rootInBitbase))
+                return wdl == 0 ? 0 : wdl > 0 ? KNOWN_WIN - ply : -KNOWN_WIN + ply;
+            alpha = std::max(alpha, -MATE_SCORE + ply);
+            beta = std::min(beta, MATE_SCORE - ply - 1);
+            if (alpha >= beta) return alpha;
+        }
+        bool pvNode = beta - alpha > 1;
+        int alphaOrig = alpha;
+        Game::Move ttMove;
+        TranspositionTable::Entry e;
+        if (tt && tt->probe(game.key, e)) {
+            ttMove = e.move;
+            int ttScore = scoreFromTT(e.score, ply);
+            if (!pvNode && ply > 0 && e.depth >= depth
+                && (e.bound == TranspositionTable::BOUND_EXACT
+                    || (e.bound == TranspositionTable::BOUND_LOWER && ttScore >= beta)
+                    || (e.bound == TranspositionTable::BOUND_UPPER && ttScore <= alpha)))
+                return ttScore;
+        }
+        Game::MoveList list;
+        game.generateLegal(list);
+        if (list.size == 0) return inCheck ? -MATE_SCORE + ply : 0;
+        int scores[256];
+        scoreMoves(list, scores, ply, ttMove);
+        int best = -INF_SCORE;
+        Game::Move bestMove;
+        for (int i=0; i<list.size; ++i) {
+            pickNext(list, scores, i);
+            Game::Move m = list.moves[i];
+            game.make(m);
+            int score;
+            if (i == 0) score = -alphaBeta(depth - 1, -beta, -alpha, ply + 1);
+            else {
+                score = -alphaBeta(depth - 1, -alpha - 1, -alpha, ply + 1);
+                if (score > alpha && score < beta) score = -alphaBeta(depth - 1, -beta, -alpha, ply + 1);
+            }
+            game.unmake();
+            if (stop) return 0;
+            if (score <= best) continue;
+            best = score;
+            bestMove = m;
+            if (score <= alpha) continue;
+            alpha = score;
+            pv[ply][ply] = m;
+            for (int j=ply+1; j<pvLength[ply+1]; ++j) pv[ply][j] = pv[ply+1][j];
+            pvLength[ply] = pvLength[ply+1];
+            if (score >= beta) {
+                if (!m.isCapture() && !m.isPromotion()) {
+                    if (killers[ply][0] != m) { killers[ply][1] = killers[ply][0]; killers[ply][0] = m; }
+                    int &h = historyScore[game.squares[m.from()]][m.to()];
+                    h = std::min(h + depth * depth, 700000);
+                }
+                break;
+            }
+        }
+        if (tt) {
+            int bound = best >= beta ? TranspositionTable::BOUND_LOWER
+                      : best > alphaOrig ? TranspositionTable::BOUND_EXACT : TranspositionTable::BOUND_UPPER;
+            tt->store(game.key, bestMove, scoreToTT(best, ply), depth, bound);
+        }
+        return best;
+    }
+
+    // Helpers skip some iterations in a per-thread pattern, so at any moment
+    // the threads are spread over neighbouring depths instead of all racing
+    // on the same one.
+    bool skipDepth(int depth) const {
+        static const int skipSize[20]  = {1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4};
+        static const int skipPhase[20] = {0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7};
+        if (threadId == 0 || depth == 1) return false;
+        int i = (threadId - 1) % 20;
+        return ((depth + skipPhase[i]) / skipSize[i]) % 2 != 0;
+    }
+
+    SearchResult run() {
+        std::fill(&killers[0][0], &killers[0][0] + MAX_PLY*2, Game::Move());
+        std::fill(&historyScore[0][0], &historyScore[0][0] + 12*64, 0);
+        SearchResult res;
+        Game::MoveList rootMoves;
+        game.generateLegal(rootMoves);
+        if (rootMoves.size == 0) return res;
+        res.best = rootMoves.moves[0];
+        int rootWdl;
+        rootInBitbase = bitbases.probe(game, rootWdl);
+        for (int depth=1; depth<=limits.maxDepth; ++depth) {
+            if (skipDepth(depth)) continue;
+            int score = alphaBeta(depth, -INF_SCORE, INF_SCORE, 0);
+            if (stop && depth > 1) break;
+            res.depth = depth;
+            res.score = score;
+            res.pv.assign(pv[0], pv[0] + pvLength[0]);
+            if (!res.pv.empty()) res.best = res.pv[0];
+            if (threadId == 0 && limits.onIteration) {
+                res.nodes = nodes;
+                res.secs = secondsSince(start);
+                limits.onIteration(res);
+            }
+            // Another iteration costs several times this one, so do not start
+            // it once half the budget is gone.
+            if (limits.timeMs > 0 && !pondering() && secondsSince(start) * 1000 >= limits.timeMs / 2) break;
+            if (std::abs(score) >= MATE_BOUND) break;
+        }
+        res.nodes = nodes;
+        res.secs = secondsSince(start);
+        return res;
+    }
+};
+
+// Lazy SMP: every thread searches the same root with its own Searcher, and
+// they only cooperate through the shared hash table. The main thread owns
+// the clock; helpers run until it finishes. The deepest completed result
+// wins, the main thread's on ties.
+static SearchResult searchSmp(const Game &g, TranspositionTable *tt, const SearchLimits &limits, int threads) {
+    if (tt) tt->newSearch();
+    std::vector<std::unique_ptr<Searcher>> workers;
+    for (int i=0; i<std::max(threads, 1); ++i) {
+        workers.push_back(std::make_unique<Searcher>(g, tt));
+        workers[i]->threadId = i;
+        workers[i]->limits = limits;
+        if (i) {
+            workers[i]->limits.timeMs = 0;
+            workers[i]->limits.maxNodes = 0;
+        }
+    }
+    std::vector<SearchResult> results(workers.size());
+    std::vector<std::thread> pool;
+    for (size_t i=1; i<workers.size(); ++i)
+        pool.emplace_back([&, i]() { results[i] = workers[i]->run(); });
+    results[0] = workers[0]->run();
+    for (size_t i=1; i<workers.size(); ++i) workers[i]->stop = true;
+    for (auto &th : pool) th.join();
+    SearchResult best = results[0];
+    for (size_t i=1; i<results.size(); ++i) {
+        if (results[i].depth > best.depth && !results[i].pv.empty()) {
+            best.best = results[i].best;
+            best.score = results[i].score;
+            best.depth = results[i].depth;
+            best.pv = results[i].pv;
+        }
+        best.nodes += results[i].nodes;
+    }
+    return best;
+}
+
+// Searches the position after the expected reply on a background thread
+// while the opponent thinks. If that reply is played the search becomes the
+// real one (its clock started when pondering did); otherwise it is stopped
+// and only the warmed hash table is kept.
+struct Ponderer {
+    SearchControl control;
+    std::thread thread;
+    SearchResult result;
+    U64 key = 0;              // position being searched
+
+    Ponderer() = default;
+    Ponderer(const Ponderer &) = delete;
+    Ponderer &operator=(const Ponderer &) = delete;
+    ~Ponderer() { cancel(); }
+
+    bool active() const { return thread.joinable(); }
+
+    void start(const Game &g, Game::Move predicted, TranspositionTable *tt, SearchLimits limits, int threads) {
+        cancel();
+        auto pos = std::make_shared<Game>(g);
+        pos->make(predicted);
+        key = pos->key;
+        control.stop = false;
+        control.pondering = true;
+        limits.control = &control;
+        thread = std::thread([this, pos, tt, limits, threads]() { result = searchSmp(*pos, tt, limits, threads); });
+    }
+
+    // True, with result set, when g is the position being pondered.
+    bool finish(const Game &g) {
+        if (!active()) return false;
+        bool hit = g.key == key;
+        if (hit) control.pondering = false;
+        else control.stop = true;
+        thread.join();
+        return hit;
+    }
+
+    void cancel() {
+        if (!active()) return;
+        control.stop = true;
+        thread.join();
+    }
+};
+
+static std::string formatScore(int score) {
+    if (score >= MATE_BOUND) return "mate " + std::to_string((MATE_SCORE - score + 1) / 2);
+    if (score <= -MATE_BOUND) return "mate -" + std::to_string((MATE_SCORE + score) / 2);
+    return "cp " + std::to_string(score);
+}
+
+static const char *benchPositions[] = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R w KQkq - 4 4",
+    "r2q1rk1/pp2bppp/2n1pn2/3p4/3P4/2NBPN2/PP3PPP/R2Q1RK1 w - - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "6k1/5ppp/8/8/8/8/5PPP/3R2K1 w - - 0 1",
+};
+
+// Fixed-depth search over a handful of positions. The total node count is
+// a signature of the search's behaviour; nps tracks its speed.
+static int runBench(int depth, int hashMb) {
+    U64 totalNodes = 0;
+    double totalSecs = 0;
+    TranspositionTable tt(hashMb);
+    for (const char *fen : benchPositions) {
+        Game g;
+        g.setFen(fen);
+        tt.clear();
+        tt.newSearch();
+        auto s = std::make_unique<Searcher>(g, &tt);
+        s->limits.timeMs = 0;
+        s->limits.maxDepth = depth;
+        SearchResult r = s->run();
+        totalNodes += r.nodes;
+        totalSecs += r.secs;
+        std::cout << "depth " << r.depth << " " << formatScore(r.score) << " best " << r.best.uci()
+                  << " nodes " << r.nodes << " nps " << r.nps() << "  " << fen << "\n";
+    }
+    std::cout << "bench: ";
+    printNodeRate(totalNodes, totalSecs);
+    return 0;
+}
+
+// Time to reach a fixed depth over the bench positions for 1, 2, 4 ... up
+// to maxThreads threads, with the speedup against one thread.
+static int runSmpBench(int depth, int maxThreads, int hashMb) {
+    std::vector<int> counts;
+    for (int t=1; t<maxThreads; t*=2) counts.push_back(t);
+    counts.push_back(maxThreads);
+    TranspositionTable tt(hashMb);
+    double baseSecs = 0;
+    std::cout << "threads   time(s)        nodes          nps  speedup\n";
+    for (int threads : counts) {
+        double secs = 0;
+        U64 nodes = 0;
+        for (const char *fen : benchPositions) {
+            Game g;
+            g.setFen(fen);
+            tt.clear();
+            SearchLimits limits;
+            limits.timeMs = 0;
+            limits.maxDepth = depth;
+            auto t0 = std::chrono::steady_clock::now();
+            SearchResult r = searchSmp(g, &tt, limits, threads);
+            secs += secondsSince(t0);
+            nodes += r.nodes;
+        }
+        if (threads == 1) baseSecs = secs;
+        std::printf("%7d %9.3f %12llu %12llu %8.2f\n", threads, secs, (unsigned long long)nodes,
+                    (unsigned long long)(nodes / std::max(secs, 1e-9)), baseSecs / std::max(secs, 1e-9));
+    }
+    return 0;
+}
+
+// ------------------------------------------------------
+// Opening book
+// ------------------------------------------------------
+// Polyglot .bin book: 16-byte big-endian entries (key, move, weight, learn)
+// sorted by key. The file is mapped and binary-searched in place, so there
+// is no parsing at startup.
+struct Book {
+    struct Hit { Game::Move move; int weight; };
+    MappedFile file;
+    size_t count = 0;
+
+    bool open(const std::string &path) {
+        if (!file.open(path) || file.size % 16 != 0) { file.close(); return false; }
+        count = file.size / 16;
+        return true;
+    }
+    U64 keyAt(size_t i) const { return readBigEndian(file.data + i*16, 8); }
+
+    // Polyglot moves are to(6) | from(6) | promotion(3), with castling
+    // written as the king taking its own rook.
+    static Game::Move decode(const Game &g, unsigned raw) {
+        int to = raw & 63, from = (raw >> 6) & 63, promo = (raw >> 12) & 7;
+        if (g.squares[from] == WK && from == 4 && (to == 7 || to == 0)) to = to == 7 ? 6 : 2;
+        if (g.squares[from] == BK && from == 60 && (to == 63 || to == 56)) to = to == 63 ? 62 : 58;
+        Game::MoveList list;
+        g.generateLegal(list);
+        for (int i=0; i<list.size; ++i) {
+            Game::Move m = list.moves[i];
+            if (m.from() != from || m.to() != to) continue;
+            if (m.isPromotion() ? m.promoType() - KNIGHT + 1 == promo : promo == 0) return m;
+        }
+        return Game::Move();
+    }
+
+    // All legal book moves for the position, in file order.
+    int probe(const Game &g, Hit *out, int max) const {
+        size_t lo = 0, hi = count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (keyAt(mid) < g.key) lo = mid + 1; else hi = mid;
+        }
+        int n = 0;
+        for (size_t i=lo; i<count && n<max && keyAt(i) == g.key; ++i) {
+            const unsigned char *e = file.data + i*16;
+            Game::Move m = decode(g, (unsigned)readBigEndian(e + 8, 2));
+            if (m.data) out[n++] = Hit{m, (int)readBigEndian(e + 10, 2)};
+        }
+        return n;
+    }
+
+    // Picks a book move with probability proportional to its weight.
+    bool pick(const Game &g, Game::Move &out) const {
+        static std::mt19937 rng((unsigned)std::chrono::steady_clock::now().time_since_epoch().count());
+        Hit hits[64];
+        int n = probe(g, hits, 64);
+        if (n == 0) return false;
+        long total = 0;
+        for (int i=0; i<n; ++i) total += hits[i].weight;
+        if (total == 0) { out = hits[0].move; return true; }
+        long r = std::uniform_int_distribution<long>(0, total - 1)(rng);
+        for (int i=0; i<n; ++i) {
+            if ((r -= hits[i].weight) < 0) { out = hits[i].move; return true; }
+        }
+        out = hits[n-1].move;
+        return true;
+    }
+};
+
+// Lists the book moves for a position with open and probe timings.
+static int runBookInfo(const std::string &path, const std::string &fen) {
+    Book book;
+    auto t0 = std::chrono::steady_clock::now();
+    if (!book.open(path)) { std::cerr << "Could not open book " << path << "\n"; return 1; }
+    double openUs = secondsSince(t0) * 1e6;
+    Game g;
+    if (!fen.empty() && !g.setFen(fen)) { std::cerr << "Bad FEN: " << fen << "\n"; return 1; }
+    Book::Hit hits[64];
+    int n = book.probe(g, hits, 64);
+    const int probes = 100000;
+    t0 = std::chrono::steady_clock::now();
+    int found = 0;
+    for (int i=0; i<probes; ++i) found += book.probe(g, hits, 64) > 0;
+    double probeUs = secondsSince(t0) * 1e6 / probes;
+    long total = 0;
+    for (int i=0; i<n; ++i) total += hits[i].weight;
+    std::cout << book.count << " entries, opened in " << openUs << " us, probe " << probeUs << " us\n";
+    for (int i=0; i<n; ++i)
+        std::cout << hits[i].move.uci() << "  weight " << hits[i].weight << "  ("
+                  << (total ? 100.0 * hits[i].weight / total : 0.0) << "%)\n";
+    if (n == 0 && !found) std::cout << "position not in book\n";
+    return 0;
+}
+
+// ------------------------------------------------------
+// PGN and EPD
+// ------------------------------------------------------
+// Readers work on memory-mapped files and hand out string_views into the
+// mapping, so replaying a game allocates nothing per move.
+
+// Parses one SAN move (Nbd7, exd6, e8=Q+, O-O-O). Check marks and
+// annotations are ignored. Returns a null move unless exactly one legal
+// move matches.
+static Game::Move parseSan(const Game &g, std::string_view san) {
+    while (!san.empty() && std::strchr("+#!?", san.back())) san.remove_suffix(1);
+    Game::MoveList list;
+    g.generateLegal(list);
+    if (san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+        int flag = san.size() == 3 ? Game::Move::KING_CASTLE : Game::Move::QUEEN_CASTLE;
+        for (int i=0; i<list.size; ++i) if (list.moves[i].flags() == flag) return list.moves[i];
+        return Game::Move();
+    }
+    int type = PAWN, promo = -1;
+    if (!san.empty() && std::strchr("NBRQK", san[0])) {
+        type = (int)(std::strchr("PNBRQK", san[0]) - "PNBRQK");
+        san.remove_prefix(1);
+    }
+    if (san.size() >= 2 && std::strchr("NBRQ", san.back()) && type == PAWN) {
+        promo = (int)(std::strchr("PNBRQK", san.back()) - "PNBRQK");
+        san.remove_suffix(san[san.size()-2] == '=' ? 2 : 1);
+    }
+    if (san.size() < 2) return Game::Move();
+    int toFile = san[san.size()-2] - 'a', toRank = san[san.size()-1] - '1';
+    if (toFile < 0 || toFile > 7 || toRank < 0 || toRank > 7) return Game::Move();
+    int fromFile = -1, fromRank = -1;
+    for (size_t i=0; i+2<san.size(); ++i) {
+        if (san[i] >= 'a' && san[i] <= 'h') fromFile = san[i] - 'a';
+        else if (san[i] >= '1' && san[i] <= '8') fromRank = san[i] - '1';
+        else if (san[i] != 'x' && san[i] != ':') return Game::Move();
+    }
+    Game::Move found;
+    int matches = 0;
+    for (int i=0; i<list.size; ++i) {
+        Game::Move m = list.moves[i];
+        if (m.to() != toRank*8 + toFile || typeOf(g.squares[m.from()]) != type) continue;
+        if ((fromFile >= 0 && m.from() % 8 != fromFile) || (fromRank >= 0 && m.from() / 8 != fromRank)) continue;
+        if (m.isPromotion() ? m.promoType() != promo : promo >= 0) continue;
+        if (m.flags() == Game::Move::KING_CASTLE || m.flags() == Game::Move::QUEEN_CASTLE) continue;
+        found = m;
+        ++matches;
+    }
+    return matches == 1 ? found : Game::Move();
+}
+
+// SAN for a legal move. g is used to test for check and is left unchanged.
+static std::string toSan(Game &g, Game::Move m) {
+    std::string s;
+    int from = m.from(), to = m.to(), type = typeOf(g.squares[from]);
+    if (m.flags() == Game::Move::KING_CASTLE) s = "O-O";
+    else if (m.flags() == Game::Move::QUEEN_CASTLE) s = "O-O-O";
+    else {
+        if (type != PAWN) {
+            s += "PNBRQK"[type];
+            Game::MoveList list;
+            g.generateLegal(list);
+            bool clash = false, sameFile = false, sameRank = false;
+            for (int i=0; i<list.size; ++i) {
+                Game::Move o = list.moves[i];
+                if (o == m || o.to() != to || typeOf(g.squares[o.from()]) != type) continue;
+                clash = true;
+                sameFile |= o.from() % 8 == from % 8;
+                sameRank |= o.from() / 8 == from / 8;
+            }
+            if (clash && (!sameFile || sameRank)) s += char('a' + from % 8);
+            if (clash && sameFile) s += char('1' + from / 8);
+        } else if (m.isCapture()) s += char('a' + from % 8);
+        if (m.isCapture()) s += 'x';
+        s += char('a' + to % 8);
+        s += char('1' + to / 8);
+        if (m.isPromotion()) { s += '='; s += "PNBRQK"[m.promoType()]; }
+    }
+    g.make(m);
+    if (g.inCheck()) {
+        Game::MoveList replies;
+        g.generateLegal(replies);
+        s += replies.size ? '+' : '#';
+    }
+    g.unmake();
+    return s;
+}
+
+struct PgnTag { std::string_view name, value; };
+
+// One game as views into the mapped file.
+struct PgnGameView {
+    static constexpr int MAX_TAGS = 32;
+    PgnTag tags[MAX_TAGS];
+    int tagCount = 0;
+    std::string_view movetext;
+
+    std::string_view tag(std::string_view name) const {
+        for (int i=0; i<tagCount; ++i) if (tags[i].name == name) return tags[i].value;
+        return std::string_view();
+    }
+};
+
+// Splits a PGN byte range into games; moves are parsed by replayPgn.
+struct PgnReader {
+    const char *pos, *end;
+
+    PgnReader(const char *begin, const char *finish) : pos(begin), end(finish) {}
+
+    bool next(PgnGameView &game) {
+        game.tagCount = 0;
+        while (pos < end && std::isspace((unsigned char)*pos)) ++pos;
+        while (pos < end && *pos == '[') {
+            const char *close = (const char *)std::memchr(pos, '\n', end - pos);
+            const char *lineEnd = close ? close : end;
+            const char *name = pos + 1, *nameEnd = name;
+            while (nameEnd < lineEnd && !std::isspace((unsigned char)*nameEnd)) ++nameEnd;
+            const char *q1 = (const char *)std::memchr(nameEnd, '"', lineEnd - nameEnd);
+            const char *q2 = q1 ? q1 + 1 : nullptr;
+            while (q2 && q2 < lineEnd && *q2 != '"') q2 += *q2 == '\\' ? 2 : 1;
+            if (q1 && q2 < lineEnd && game.tagCount < PgnGameView::MAX_TAGS)
+                game.tags[game.tagCount++] = {std::string_view(name, nameEnd - name), std::string_view(q1 + 1, q2 - q1 - 1)};
+            pos = lineEnd;
+            while (pos < end && std::isspace((unsigned char)*pos)) ++pos;
+        }
+        // Movetext runs up to the next tag line outside a comment.
+        const char *start = pos;
+        bool comment = false, lineStart = false;
+        for (; pos < end; ++pos) {
+            char c = *pos;
+            if (lineStart && c == '[' && !comment) break;
+            if (c == '{') comment = true;
+            else if (c == '}') comment = false;
+            lineStart = c == '\n' || (lineStart && (c == ' ' || c == '\r' || c == '\t'));
+        }
+        game.movetext = std::string_view(start, pos - start);
+        return game.tagCount > 0 || !game.movetext.empty();
+    }
+};
+
+// Replays a game from its FEN tag or the start position, calling
+// onMove(g, move) before each move is made. Returns the number of plies,
+// or -1 at the first move that does not parse or is illegal.
+template <class OnMove>
+static int replayPgn(const PgnGameView &game, Game &g, OnMove onMove) {
+    std::string_view fen = game.tag("FEN");
+    if (fen.empty()) g.reset();
+    else if (!g.setFen(std::string(fen))) return -1;
+    const char *p = game.movetext.data(), *end = p + game.movetext.size();
+    int plies = 0, depth = 0;
+    while (p < end) {
+        char c = *p;
+        if (std::isspace((unsigned char)c)) { ++p; continue; }
+        if (c == '{') { const char *q = (const char *)std::memchr(p, '}', end - p); p = q ? q + 1 : end; continue; }
+        if (c == ';' || (c == '%' && (p == game.movetext.data() || p[-1] == '\n'))) {
+            const char *q = (const char *)std::memchr(p, '\n', end - p);
+            p = q ? q + 1 : end;
+            continue;
+        }
+        if (c == '(') { ++depth; ++p; continue; }
+        if (c == ')') { depth -= depth > 0; ++p; continue; }
+        const char *tokenEnd = p;
+        while (tokenEnd < end && !std::isspace((unsigned char)*tokenEnd) && !std::strchr("{}();", *tokenEnd)) ++tokenEnd;
+        // A stray '}' (or a NUL) starts no token; skip it or p never moves.
+        if (tokenEnd == p) { ++p; continue; }
+        std::string_view token(p, tokenEnd - p);
+        p = tokenEnd;
+        if (depth > 0 || token[0] == '$' || token == "*" || token == "1-0" || token == "0-1" || token == "1/2-1/2") continue;
+        // Move numbers, possibly glued to the move: "12.", "12...", "1.e4".
+        size_t i = 0;
+        while (i < token.size() && std::isdigit((unsigned char)token[i])) ++i;
+        if (i > 0 && i < token.size() && token[i] == '.') {
+            while (i < token.size() && token[i] == '.') ++i;
+            token.remove_prefix(i);
+            if (token.empty()) continue;
+        }
+        Game::Move m = parseSan(g, token);
+        if (!m.data) return -1;
+        onMove(g, m);
+        g.make(m);
+        ++plies;
+    }
+    return plies;
+}
+
+// Movetext the parser has to get through: comments, variations, NAGs and
+// malformed input, with the plies expected on the main line (-1 = rejected).
+struct PgnCase { const char *name; const char *movetext; int plies; };
+static const PgnCase pgnSuite[] = {
+    {"plain",          "1. e4 e5 2. Nf3 Nc6 *", 4},
+    {"glued-numbers",  "1.e4 e5 2.Nf3 Nc6 3.Bb5 *", 5},
+    {"black-number",   "1. e4 1... e5 2. Nf3 *", 3},
+    {"comments",       "1. e4 {best by test} e5 ; rest of line\n2. Nf3 *", 3},
+    {"nags",           "1. e4! $1 e5?! $6 2. Nf3 *", 3},
+    {"variations",     "1. e4 e5 (1... c5 2. Nf3 (2. c3) d6) 2. Nf3 *", 3},
+    {"stray-brace",    "1. e4 } e5 2. Nf3 *", 3},
+    {"stray-brace-var","1. e4 e5 (1... c5 } 2. Nf3) 2. Nf3 *", 3},
+    {"stray-paren",    "1. e4 ) e5 2. Nf3 *", 3},
+    {"open-comment",   "1. e4 e5 {never closed 2. Nf3", 2},
+    {"open-variation", "1. e4 e5 (1... c5 2. Nf3", 2},
+    {"illegal",        "1. e4 e5 2. Ke3 *", -1},
+};
+
+static int runPgnSuite() {
+    int failed = 0;
+    for (const PgnCase &c : pgnSuite) {
+        PgnGameView view;
+        view.movetext = c.movetext;
+        Game g;
+        int plies = replayPgn(view, g, [](const Game &, Game::Move) {});
+        bool ok = plies == c.plies;
+        if (!ok) ++failed;
+        std::cout << (ok ? "ok   " : "FAIL ") << c.name << ": " << plies << " plies";
+        if (!ok) std::cout << ", expected " << c.plies;
+        std::cout << "\n";
+    }
+    std::cout << "suite: " << (sizeof(pgnSuite)/sizeof(pgnSuite[0]) - failed) << "/"
+              << sizeof(pgnSuite)/sizeof(pgnSuite[0]) << " passed\n";
+    return failed ? 1 : 0;
+}
+
+// Writes one game with seven-tag roster first, FEN when it does not start
+// from the initial position, and movetext wrapped at 80 columns.
+static void writePgn(std::ostream &out, const std::vector<std::pair<std::string, std::string>> &tags,
+                     const std::string &startFen, const std::vector<Game::Move> &moves, const std::string &result) {
+    for (const auto &t : tags) out << "[" << t.first << " \"" << t.second << "\"]\n";
+    if (startFen != Game::START_FEN) out << "[SetUp \"1\"]\n[FEN \"" << startFen << "\"]\n";
+    out << "\n";
+    Game g;
+    g.setFen(startFen);
+    std::string line;
+    auto emit = [&](const std::string &word) {
+        if (!line.empty() && line.size() + 1 + word.size() > 80) { out << line << "\n"; line.clear(); }
+        line += (line.empty() ? "" : " ") + word;
+    };
+    for (size_t i=0; i<moves.size(); ++i) {
+        std::string number = g.whiteToMove ? std::to_string(g.fullmoves) + ". "
+                           : i == 0 ? std::to_string(g.fullmoves) + "... " : "";
+        emit(number + toSan(g, moves[i]));
+        g.make(moves[i]);
+    }
+    emit(result);
+    out << line << "\n\n";
+}
+
+// Start position and moves of a game still held in the undo ring.
+static std::string gameRecord(const Game &g, std::vector<Game::Move> &moves) {
+    Game start = g;
+    while (start.canUndo()) start.undo();
+    moves.clear();
+    for (int i=g.plies - g.undoable; i<g.plies; ++i) moves.push_back(g.history[i & (Game::HISTORY_CAP-1)].move);
+    return start.fen();
+}
+
+// Appends a finished game to a PGN file.
+static bool appendPgn(const std::string &path, const std::vector<std::pair<std::string, std::string>> &tags,
+                      const std::string &startFen, const std::vector<Game::Move> &moves, const std::string &result) {
+    std::ofstream out(path, std::ios::app);
+    if (!out) return false;
+    writePgn(out, tags, startFen, moves, result);
+    return (bool)out;
+}
+
+// Replays every game of a PGN file across threads. Each thread takes a
+// slice of the mapping that starts at an [Event tag.
+static int runPgnReplay(const std::string &path, int threads) {
+    MappedFile file;
+    if (!file.open(path)) { std::cerr << "Could not open " << path << "\n"; return 1; }
+    const char *data = (const char *)file.data, *end = data + file.size;
+    std::vector<const char *> cuts(1, data);
+    for (int t=1; t<threads; ++t) {
+        const char *from = std::max(data + file.size * t / threads, cuts.back());
+        std::string_view rest(from, end - from);
+        size_t at = rest.find("\n[Event ");
+        cuts.push_back(at == std::string_view::npos ? end : from + at + 1);
+    }
+    cuts.push_back(end);
+    std::atomic<U64> games{0}, plies{0}, bad{0};
+    auto t0 = std::chrono::steady_clock::now();
+    auto worker = [&](int t) {
+        PgnReader reader(cuts[t], cuts[t+1]);
+        PgnGameView view;
+        auto g = std::make_unique<Game>();
+        U64 n = 0, p = 0, b = 0;
+        while (reader.next(view)) {
+            int r = replayPgn(view, *g, [](const Game &, Game::Move) {});
+            ++n;
+            if (r < 0) ++b; else p += r;
+        }
+        games += n;
+        plies += p;
+        bad += b;
+    };
+    std::vector<std::thread> pool;
+    for (int t=1; t<threads; ++t) pool.emplace_back(worker, t);
+    worker(0);
+    for (auto &th : pool) th.join();
+    double secs = secondsSince(t0);
+    std::cout << games << " games, " << plies << " plies, " << bad << " with bad moves, "
+              << file.size / 1048576.0 << " MB in " << secs << " s ("
+              << (U64)(games / std::max(secs, 1e-9)) << " games/s, " << (U64)(plies / std::max(secs, 1e-9)) << " plies/s)\n";
+    return 0;
+}
+
+// One EPD test position: best moves (bm), moves to avoid (am) and the
+// length of a direct mate (dm).
+struct EpdPosition {
+    std::string fen, id;
+    Game::Move best[8], avoid[8];
+    int bestCount = 0, avoidCount = 0;
+    int mateIn = 0;
+
+    bool solvedBy(Game::Move m) const {
+        for (int i=0; i<avoidCount; ++i) if (avoid[i] == m) return false;
+        if (bestCount == 0) return avoidCount > 0;
+        for (int i=0; i<bestCount; ++i) if (best[i] == m) return true;
+        return false;
+    }
+};
+
+// Reads "board side castling ep op arg; op arg;" lines from a mapped file.
+static bool loadEpd(const std::string &path, std::vector<EpdPosition> &out) {
+    MappedFile file;
+    if (!file.open(path)) return false;
+    std::string_view rest((const char *)file.data, file.size);
+    auto g = std::make_unique<Game>();
+    while (!rest.empty()) {
+        size_t nl = rest.find('\n');
+        std::string_view line = rest.substr(0, nl);
+        rest.remove_prefix(nl == std::string_view::npos ? rest.size() : nl + 1);
+        auto nextWord = [&line]() {
+            while (!line.empty() && std::isspace((unsigned char)line[0])) line.remove_prefix(1);
+            size_t n = 0;
+            while (n < line.size() && !std::isspace((unsigned char)line[n]) && line[n] != ';') ++n;
+            std::string_view w = line.substr(0, n);
+            line.remove_prefix(n);
+            return w;
+        };
+        EpdPosition pos;
+        for (int i=0; i<4; ++i) {
+            std::string_view w = nextWord();
+            pos.fen += std::string(w) + (i < 3 ? " " : "");
+        }
+        if (pos.fen.empty() || pos.fen[0] == '#' || !g->setFen(pos.fen)) continue;
+        while (!line.empty()) {
+            std::string_view op = nextWord();
+            size_t semi = line.find(';');
+            std::string_view args = line.substr(0, semi);
+            line.remove_prefix(semi == std::string_view::npos ? line.size() : semi + 1);
+            while (!args.empty() && std::isspace((unsigned char)args[0])) args.remove_prefix(1);
+            if (op == "id") {
+                if (args.size() >= 2 && args[0] == '"') args = args.substr(1, args.find('"', 1) - 1);
+                pos.id = std::string(args);
+            } else if (op == "dm") {
+                pos.mateIn = std::atoi(std::string(args).c_str());
+            } else if (op == "bm" || op == "am") {
+                std::istringstream in{std::string(args)};
+                std::string san;
+                while (in >> san) {
+                    Game::Move m = parseSan(*g, san);
+                    if (!m.data) continue;
+                    if (op == "bm" && pos.bestCount < 8) pos.best[pos.bestCount++] = m;
+                    if (op == "am" && pos.avoidCount < 8) pos.avoid[pos.avoidCount++] = m;
+                }
+            }
+        }
+        if (pos.id.empty()) pos.id = "#" + std::to_string(out.size() + 1);
+        out.push_back(pos);
+    }
+    return true;
+}
+
+// Searches every EPD position for --movetime on a pool of single-threaded
+// workers and counts the ones whose best move matches bm (and avoids am).
+static int runEpdSolve(const std::string &path, int threads, int moveTimeMs, int hashMb) {
+    std::vector<EpdPosition> suite;
+    if (!loadEpd(path, suite)) { std::cerr << "Could not open " << path << "\n"; return 1; }
+    std::mutex lock;
+    std::atomic<size_t> next{0};
+    int solved = 0;
+    double searchSecs = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    auto worker = [&]() {
+        TranspositionTable tt(hashMb);
+        auto g = std::make_unique<Game>();
+        for (size_t i; (i = next++) < suite.size(); ) {
+            const EpdPosition &pos = suite[i];
+            g->setFen(pos.fen);
+            tt.clear();
+            SearchLimits limits;
+            limits.timeMs = moveTimeMs;
+            SearchResult r = searchSmp(*g, &tt, limits, 1);
+            // Mate or stalemate on the board leaves no move: that fails a bm
+            // and satisfies an am, which is what solvedBy gives a null move.
+            bool ok = pos.solvedBy(r.best);
+            std::string san = r.best.data ? toSan(*g, r.best) : "(none)";
+            std::lock_guard<std::mutex> guard(lock);
+            solved += ok;
+            searchSecs += r.secs;
+            std::cout << (ok ? "solved " : "failed ") << pos.id << ": " << san << "  (depth " << r.depth
+                      << ", " << formatScore(r.score) << ", " << r.secs * 1000 << " ms)\n";
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t=1; t<threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto &th : pool) th.join();
+    double secs = secondsSince(t0);
+    std::cout << "Solved " << solved << "/" << suite.size() << " in " << secs << " s, "
+              << searchSecs * 1000 / std::max<size_t>(suite.size(), 1) << " ms per position on "
+              << threads << " threads\n";
+    return 0;
+}
 
-    struct Snap {
-        Board b;
-        bool whiteToMove;
-        bool wkMoved, wqMoved, bkMoved, bqMoved;
-        std::pair<int,int> enPassant;
-        int fullmoves;
+// ------------------------------------------------------
+// Mate solver
+// ------------------------------------------------------
+// Depth-first proof-number search (df-pn) for "mate in N". Proof and
+// disproof numbers are kept from the side to move's view (phi/delta): at
+// attacker nodes phi proves the mate, at defender nodes it proves that the
+// defender survives the horizon. The remaining plies are hashed into the
+// key, so results for different horizons never mix.
+struct DfpnTable {
+    struct Entry {
+        U64 key = 0;
+        std::uint32_t phi = 0, delta = 0;
+        std::uint32_t work = 0;       // nodes spent on it, for replacement
+        Game::Move best;
     };
-    std::vector<Snap> history;
+    std::vector<Entry> entries;
+    size_t mask = 0;
 
-    Snap snapshot() const {
-        return Snap{b, whiteToMove, wkMoved, wqMoved, bkMoved, bqMoved, enPassant, fullmoves};
+    explicit DfpnTable(int mb) {
+        size_t n = 2;
+        while (n * 2 * sizeof(Entry) <= ((size_t)std::max(mb, 1) << 20)) n *= 2;
+        entries.resize(n);
+        mask = n - 1;
     }
-    void restore(const Snap &s) {
-        b = s.b;
-        whiteToMove = s.whiteToMove;
-        wkMoved = s.wkMoved; wqMoved = s.wqMoved; bkMoved = s.bkMoved; bqMoved = s.bqMoved;
-        enPassant = s.enPassant;
-        fullmoves = s.fullmoves;
+    void clear() { std::fill(entries.begin(), entries.end(), Entry()); }
+    const Entry *find(U64 key) const {
+        const Entry &a = entries[key & mask], &b = entries[(key & mask) ^ 1];
+        return a.key == key ? &a : b.key == key ? &b : nullptr;
     }
-    bool canUndo() const { return !history.empty(); }
-    bool undo() {
-        if (!canUndo()) return false;
-        restore(history.back());
-        history.pop_back();
-        return true;
+    // Two-way set: overwrite our own slot, else evict the cheaper one.
+    void store(U64 key, std::uint32_t phi, std::uint32_t delta, U64 work, Game::Move best) {
+        Entry *a = &entries[key & mask], *b = &entries[(key & mask) ^ 1];
+        Entry *e = a->key == key ? a : b->key == key ? b : a->work <= b->work ? a : b;
+        *e = Entry{key, phi, delta, (std::uint32_t)std::min<U64>(work, 0xFFFFFFFFu), best};
     }
-    void clearHistory() { history.clear(); }
+};
 
-    Game() { reset(); }
+struct MateSolver {
+    static constexpr std::uint32_t INF = 1u << 30;
+    Game game;
+    DfpnTable table;
+    U64 nodes = 0;
+    int timeMs = 0;
+    bool aborted = false;
+    std::chrono::steady_clock::time_point start;
 
-    void reset() {
-        b = {
-            "rnbqkbnr",
-            "pppppppp",
-            "........",
-            "........",
-            "........",
-            "........",
-            "PPPPPPPP",
-            "RNBQKBNR"
-        };
-        whiteToMove = true;
-        wkMoved = wqMoved = bkMoved = bqMoved = false;
-        enPassant = {-1,-1};
-        fullmoves = 1;
-        clearHistory();
+    explicit MateSolver(int hashMb) : table(hashMb) {}
+
+    bool setPosition(const std::string &fen) {
+        table.clear();
+        nodes = 0;
+        aborted = false;
+        start = std::chrono::steady_clock::now();
+        return game.setFen(fen);
     }
 
-    static bool inBounds(int r,int c){ return r>=0 && r<8 && c>=0 && c<8; }
-    static bool isWhite(char p){ return std::isupper((unsigned char)p); }
-    static bool isBlack(char p){ return std::islower((unsigned char)p); }
-    static bool empty(char p){ return p=='.'; }
+    static U64 nodeKey(U64 key, int plies) { return key ^ (0x9E3779B97F4A7C15ULL * (U64)(plies + 1)); }
+    static std::uint32_t add(std::uint32_t a, std::uint32_t b) { return std::min(a + b, INF); }
 
-    void print() const {
-        std::system("cls");
-        std::cout << "   a b c d e f g h\n";
-        for (int r=0;r<8;++r){
-            std::cout << 8-r << "  ";
-            for (int c=0;c<8;++c){
-                char ch = b[r][c];
-                std::cout << (ch=='.'?'.':ch) << ' ';
+    // Value of the current node before it is searched: exact for mates,
+    // stalemates and the horizon, else (1, number of moves).
+    void initial(int plies, std::uint32_t &phi, std::uint32_t &delta) {
+        if (const DfpnTable::Entry *e = table.find(nodeKey(game.key, plies))) { phi = e->phi; delta = e->delta; return; }
+        bool attacker = plies % 2 == 1;
+        Game::MoveList list;
+        game.generateLegal(list);
+        if (list.size == 0) {
+            bool survives = !attacker && !game.inCheck();
+            phi = survives ? 0 : INF;
+            delta = survives ? INF : 0;
+        } else if (plies == 0) {
+            phi = 0;
+            delta = INF;
+        } else {
+            phi = 1;
+            delta = (std::uint32_t)list.size;
+        }
+    }
+
+    // Searches the current node until its phi reaches thPhi or its delta
+    // reaches thDelta (or the time runs out).
+    void mid(int plies, std::uint32_t thPhi, std::uint32_t thDelta, std::uint32_t &phi, std::uint32_t &delta,
+             Game::Move *bestOut = nullptr) {
+        if ((++nodes & 4095) == 0 && timeMs > 0 && secondsSince(start) * 1000 >= timeMs) aborted = true;
+        U64 startNodes = nodes;
+        Game::MoveList list;
+        game.generateLegal(list);
+        std::uint32_t childPhi[256], childDelta[256];
+        for (int i=0; i<list.size; ++i) {
+            game.make(list.moves[i]);
+            initial(plies - 1, childPhi[i], childDelta[i]);
+            game.unmake();
+        }
+        int best = -1;
+        while (true) {
+            // Ours is won if one child is lost, lost if every child is won.
+            std::uint32_t second = INF;
+            phi = INF;
+            delta = 0;
+            best = -1;
+            for (int i=0; i<list.size; ++i) {
+                if (childDelta[i] < phi) { second = phi; phi = childDelta[i]; best = i; }
+                else if (childDelta[i] < second) second = childDelta[i];
+                delta = add(delta, childPhi[i]);
             }
-            std::cout << " " << 8-r << "\n";
+            if (phi >= thPhi || delta >= thDelta || aborted) break;
+            std::uint32_t childThPhi = std::min<std::uint32_t>(thDelta - delta + childPhi[best], INF);
+            std::uint32_t childThDelta = std::min(thPhi, second + 1);
+            game.make(list.moves[best]);
+            mid(plies - 1, childThPhi, childThDelta, childPhi[best], childDelta[best]);
+            game.unmake();
         }
-        std::cout << "   a b c d e f g h\n";
-        std::cout << (whiteToMove ? "White" : "Black") << " to move"
-                  << "  (enter moves like e2e4 or e7e8q for promotion)\n";
+        Game::Move move = best >= 0 ? list.moves[best] : Game::Move();
+        if (!aborted) table.store(nodeKey(game.key, plies), phi, delta, nodes - startNodes, move);
+        if (bestOut) *bestOut = move;
     }
 
-    static bool algToRC(const std::string &s, int &r, int &c){
-        if (s.size()<2) return false;
-        char f = std::tolower(s[0]);
-        char R = s[1];
-        if (f<'a' || f>'h' || R<'1' || R>'8') return false;
-        c = f - 'a';
-        r = 8 - (R - '0');
-        return true;
+    // Proves (or refutes) a mate within the given number of moves: 1 when
+    // proven, 0 when refuted, -1 when the time ran out.
+    int solve(int mateIn) {
+        std::uint32_t phi, delta;
+        initial(2 * mateIn - 1, phi, delta);
+        if (phi != 0 && delta != 0) mid(2 * mateIn - 1, INF, INF, phi, delta);
+        return aborted ? -1 : phi == 0 ? 1 : 0;
     }
 
-    bool pathClear(int sr,int sc,int tr,int tc) const {
-        int dr = (tr>sr) ? 1 : (tr<sr) ? -1 : 0;
-        int dc = (tc>sc) ? 1 : (tc<sc) ? -1 : 0;
-        int r = sr + dr, c = sc + dc;
-        while (r != tr || c != tc) {
-            if (!inBounds(r,c)) return false;
-            if (!empty(b[r][c])) return false;
-            r += dr; c += dc;
+    // Counts the nodes of the proof tree below a proven node and fills the
+    // main line, taking the defence that needs the largest proof. Parts the
+    // table has lost are proven again.
+    U64 proofSize(int plies, std::vector<Game::Move> &line) {
+        Game::MoveList list;
+        game.generateLegal(list);
+        if (list.size == 0) return 1;
+        if (plies % 2 == 1) {
+            std::uint32_t phi, delta;
+            Game::Move best;
+            mid(plies, INF, INF, phi, delta, &best);
+            if (aborted || !best.data) return 1;
+            line.push_back(best);
+            game.make(best);
+            U64 size = 1 + proofSize(plies - 1, line);
+            game.unmake();
+            return size;
         }
-        return true;
+        U64 size = 1, longest = 0;
+        std::vector<Game::Move> mainLine;
+        for (int i=0; i<list.size; ++i) {
+            std::vector<Game::Move> sub(1, list.moves[i]);
+            game.make(list.moves[i]);
+            U64 s = proofSize(plies - 1, sub);
+            game.unmake();
+            size += s;
+            if (s > longest) { longest = s; mainLine.swap(sub); }
+        }
+        line.insert(line.end(), mainLine.begin(), mainLine.end());
+        return size;
     }
+};
 
-    bool isAttacked(int tr,int tc,bool attackerIsWhite) const {
-        for (int sr=0; sr<8; ++sr) for (int sc=0; sc<8; ++sc) {
-            char p = b[sr][sc];
-            if (p=='.') continue;
-            if (attackerIsWhite != isWhite(p)) continue;
-            char lower = std::tolower((unsigned char)p);
-            int dr = tr - sr, dc = tc - sc;
-            int adr = std::abs(dr), adc = std::abs(dc);
-            switch (lower) {
-                case 'p': {
-                    int dir = attackerIsWhite ? -1 : 1;
-                    if (dr == dir && std::abs(dc) == 1) return true;
-                    break;
-                }
-                case 'n': if ((adr==2 && adc==1) || (adr==1 && adc==2)) return true; break;
-                case 'b': if (adr==adc && adr>0 && pathClear(sr,sc,tr,tc)) return true; break;
-                case 'r': if ((adr==0 && adc>0 || adr>0 && adc==0) && pathClear(sr,sc,tr,tc)) return true; break;
-                case 'q': if (((adr==adc && adr>0) || (adr==0 && adc>0) || (adr>0 && adc==0)) && pathClear(sr,sc,tr,tc)) return true; break;
-                case 'k': if (std::max(adr,adc)==1) return true; break;
-                default: break;
-            }
+// Solves one position, trying mate in 1 up to maxMoves so the shortest
+// mate is reported. Returns true if a mate was proven.
+static bool solveMatePosition(MateSolver &solver, const std::string &fen, const std::string &name,
+                              int maxMoves, U64 &totalNodes) {
+    if (!solver.setPosition(fen)) { std::cout << name << ": bad FEN\n"; return false; }
+    int found = 0, result = 0;
+    for (int n=1; n<=maxMoves && result == 0; ++n) {
+        result = solver.solve(n);
+        if (result == 1) found = n;
+    }
+    double secs = secondsSince(solver.start);
+    U64 searched = solver.nodes;
+    totalNodes += searched;
+    std::cout << name << ": ";
+    if (result == 1) {
+        std::vector<Game::Move> line;
+        U64 size = solver.proofSize(2 * found - 1, line);
+        std::cout << "mate in " << found << ":";
+        Game replay = solver.game;
+        for (Game::Move m : line) {
+            std::cout << " " << toSan(replay, m);
+            replay.make(m);
         }
-        return false;
+        std::cout << "  (proof " << size << " nodes, ";
+    } else {
+        std::cout << (result == 0 ? "no mate in " : "unknown within ") << maxMoves << "  (";
     }
+    std::cout << searched << " nodes, " << secs * 1000 << " ms, "
+              << (U64)(searched / std::max(secs, 1e-9)) << " nps)\n";
+    return result == 1;
+}
 
-    bool findKing(bool white, int &kr,int &kc) const {
-        char K = white ? 'K' : 'k';
-        for (int r=0;r<8;++r) for (int c=0;c<8;++c) if (b[r][c]==K) { kr=r; kc=c; return true; }
-        return false;
+// solve-mate <moves> <fen|file>: a file is read as EPD, where a dm
+// operation overrides the move count for that line.
+static int runSolveMate(int maxMoves, const std::string &target, int timeMs, int hashMb) {
+    std::vector<EpdPosition> batch;
+    std::ifstream probe(target);
+    if (probe.good()) {
+        if (!loadEpd(target, batch)) { std::cerr << "Could not read " << target << "\n"; return 1; }
+    } else {
+        EpdPosition one;
+        one.fen = target;
+        one.id = target;
+        batch.push_back(one);
     }
+    auto solver = std::make_unique<MateSolver>(hashMb);
+    solver->timeMs = timeMs;
+    int solved = 0;
+    U64 nodes = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    for (const EpdPosition &p : batch)
+        solved += solveMatePosition(*solver, p.fen, p.id, p.mateIn > 0 ? p.mateIn : maxMoves, nodes);
+    double secs = secondsSince(t0);
+    std::cout << "Solved " << solved << "/" << batch.size() << " in " << secs << " s, " << nodes << " nodes ("
+              << (U64)(nodes / std::max(secs, 1e-9)) << " nps)\n";
+    return 0;
+}
 
-    bool pseudoLegal(int sr,int sc,int tr,int tc, char /*promo*/ = 0) const {
-        if (!inBounds(sr,sc) || !inBounds(tr,tc)) return false;
-        char p = b[sr][sc];
-        if (p=='.') return false;
-        bool movingWhite = isWhite(p);
-        if (movingWhite != whiteToMove) return false;
-        char target = b[tr][tc];
-        if (target != '.' && (isWhite(target) == movingWhite)) return false;
-        int dr = tr - sr, dc = tc - sc;
-        int adr = std::abs(dr), adc = std::abs(dc);
-        char lower = std::tolower((unsigned char)p);
-        if (lower == 'p') {
-            int dir = movingWhite ? -1 : 1;
-            if (dc==0 && dr==dir && target=='.') return true;
-            if (dc==0 && dr==2*dir && target=='.') {
-                int startRow = movingWhite ? 6 : 1;
-                if (sr==startRow && b[sr+dir][sc]=='.') return true;
+// ------------------------------------------------------
+// Game database
+// ------------------------------------------------------
+// db-build indexes every position of a set of PGN files by Zobrist key.
+// Workers replay slices of the inputs in parallel and spill sorted runs of
+// (key, move, game, result) records whenever their share of --ram fills up.
+// The runs are then merged into one file holding the sorted keys, a
+// per-move summary for each key, the posting list of games for each key,
+// and where every game sits in its source file. Lookups binary-search the
+// mapped keys and touch only the pages they need.
+struct DbRecord {
+    U64 key;
+    std::uint32_t game;
+    std::uint16_t move;
+    std::uint8_t result;      // 0 White won, 1 draw, 2 Black won, 3 unknown
+    std::uint8_t pad;
+    bool operator<(const DbRecord &o) const {
+        return key != o.key ? key < o.key : move != o.move ? move < o.move : game < o.game;
+    }
+};
+struct DbPosting { std::uint32_t game; std::uint16_t move; std::uint8_t result, pad; };
+struct DbMoveStats { std::uint16_t move, pad; std::uint32_t games, results[4]; };
+struct DbGameRef {
+    std::uint32_t game, file;
+    U64 offset;               // start of the game in its PGN file
+    bool operator<(const DbGameRef &o) const { return game < o.game; }
+};
+struct DbHeader {
+    char magic[8];
+    U64 positions, postings, stats, games, files;
+    U64 keysAt, postingIndexAt, statsIndexAt, postingsAt, statsAt, gamesAt, namesAt;
+};
+static const char dbMagic[8] = {'A', 'S', 'Y', 'S', 'D', 'B', '0', '1'};
+
+// Sequential reader over a file of fixed-size records. ok() turns false if
+// the file could not be opened or a read failed, so a missing run is an
+// error rather than an empty one.
+template <class T>
+struct RecordReader {
+    FILE *f = nullptr;
+    std::vector<T> buf;
+    size_t pos = 0, len = 0;
+    bool failed = false;
+
+    RecordReader(const std::string &path, size_t bufferBytes) : buf(std::max<size_t>(bufferBytes / sizeof(T), 1)) {
+        f = std::fopen(path.c_str(), "rb");
+        failed = !f;
+    }
+    ~RecordReader() { if (f) std::fclose(f); }
+    bool ok() const { return !failed; }
+    bool next(T &out) {
+        if (pos == len) {
+            len = f ? std::fread(buf.data(), sizeof(T), buf.size(), f) : 0;
+            pos = 0;
+            if (len == 0) {
+                if (f && std::ferror(f)) failed = true;
                 return false;
             }
-            if (adr==1 && adc==1) {
-                if (target!='.' && (isWhite(target) != movingWhite)) return true;
-                if (target=='.' && enPassant.first==tr && enPassant.second==tc) return true;
+        }
+        out = buf[pos++];
+        return true;
+    }
+};
+
+// K-way merge of sorted record files within about bufferBytes in total.
+template <class T, class OnRecord>
+static bool mergeOnce(const std::vector<std::string> &paths, size_t bufferBytes, OnRecord onRecord) {
+    std::vector<std::unique_ptr<RecordReader<T>>> readers;
+    for (const std::string &p : paths) {
+        readers.push_back(std::make_unique<RecordReader<T>>(p, bufferBytes / std::max<size_t>(paths.size(), 1)));
+        if (!readers.back()->ok()) return false;
+    }
+    using Head = std::pair<T, size_t>;
+    auto later = [](const Head &a, const Head &b) { return b.first < a.first; };
+    std::vector<Head> heap;
+    for (size_t i=0; i<readers.size(); ++i) {
+        T r;
+        if (readers[i]->next(r)) heap.push_back({r, i});
+    }
+    std::make_heap(heap.begin(), heap.end(), later);
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        Head h = heap.back();
+        heap.pop_back();
+        onRecord(h.first);
+        if (readers[h.second]->next(h.first)) {
+            heap.push_back(h);
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+    for (const auto &r : readers)
+        if (!r->ok()) return false;
+    return true;
+}
+
+// Merges any number of sorted record files while keeping at most
+// maxMergeWidth of them open: wider inputs are first merged in groups into
+// intermediate files named tempPrefix + N, pass after pass. Returns false
+// if a file cannot be opened, read or written.
+static const size_t maxMergeWidth = 64;
+
+template <class T, class OnRecord>
+static bool mergeSortedFiles(std::vector<std::string> paths, const std::string &tempPrefix, size_t bufferBytes, OnRecord onRecord) {
+    size_t temps = 0;
+    bool intermediate = false, ok = true;
+    while (ok && paths.size() > maxMergeWidth) {
+        std::vector<std::string> next;
+        for (size_t i=0; ok && i<paths.size(); i+=maxMergeWidth) {
+            std::vector<std::string> group(paths.begin() + i, paths.begin() + std::min(i + maxMergeWidth, paths.size()));
+            std::string path = tempPrefix + std::to_string(temps++);
+            next.push_back(path);
+            FILE *f = std::fopen(path.c_str(), "wb");
+            if (!f) { ok = false; break; }
+            bool written = true;
+            ok = mergeOnce<T>(group, bufferBytes, [&](const T &r) { written &= std::fwrite(&r, sizeof(T), 1, f) == 1; });
+            ok = (std::fclose(f) == 0) && written && ok;
+        }
+        if (intermediate)
+            for (const std::string &p : paths) std::remove(p.c_str());
+        paths.swap(next);
+        intermediate = true;
+    }
+    if (ok) ok = mergeOnce<T>(paths, bufferBytes, onRecord);
+    if (intermediate)
+        for (const std::string &p : paths) std::remove(p.c_str());
+    return ok;
+}
+
+template <class T>
+static bool writeRecords(const std::string &path, const T *data, size_t count) {
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (!f) return false;
+    bool ok = std::fwrite(data, sizeof(T), count, f) == count;
+    return std::fclose(f) == 0 && ok;
+}
+
+static U64 fileSize(const std::string &path) {
+    FILE *f = std::fopen(path.c_str(), "rb");
+    if (!f) return 0;
+    std::fseek(f, 0, SEEK_END);
+    long long n = std::ftell(f);
+    std::fclose(f);
+    return n > 0 ? (U64)n : 0;
+}
+
+// Appends a whole file to out, padded to 8 bytes, and sets at to its
+// offset. False if the file cannot be read or out cannot be written.
+static bool appendFile(FILE *out, const std::string &path, U64 &at) {
+    long long pos = std::ftell(out);
+    if (pos < 0) return false;
+    at = (U64)pos;
+    FILE *in = std::fopen(path.c_str(), "rb");
+    if (!in) return false;
+    std::vector<char> buf(1 << 20);
+    size_t n;
+    bool ok = true;
+    while (ok && (n = std::fread(buf.data(), 1, buf.size(), in)) > 0) ok = std::fwrite(buf.data(), 1, n, out) == n;
+    ok = ok && !std::ferror(in);
+    std::fclose(in);
+    static const char zeros[8] = {};
+    size_t pad = (size_t)((8 - std::ftell(out) % 8) % 8);
+    return ok && std::fwrite(zeros, 1, pad, out) == pad;
+}
+
+static int runDbBuild(const std::string &outPath, const std::vector<std::string> &inputs, int threads, int ramMb) {
+    auto t0 = std::chrono::steady_clock::now();
+    // Work items are slices of about 32 MB that start at an [Event tag.
+    struct Slice { size_t file; const char *begin, *end; };
+    std::vector<std::unique_ptr<MappedFile>> files;
+    std::vector<Slice> slices;
+    for (size_t i=0; i<inputs.size(); ++i) {
+        files.push_back(std::make_unique<MappedFile>());
+        if (!files[i]->open(inputs[i])) { std::cerr << "Could not open " << inputs[i] << "\n"; return 1; }
+        const char *data = (const char *)files[i]->data, *end = data + files[i]->size, *from = data;
+        while (from < end) {
+            const char *to = end;
+            if ((size_t)(end - from) > (32u << 20)) {
+                std::string_view rest(from + (32u << 20), end - from - (32u << 20));
+                size_t at = rest.find("\n[Event ");
+                if (at != std::string_view::npos) to = rest.data() + at + 1;
             }
-            return false;
-        } else if (lower == 'n') {
-            return (adr==2 && adc==1) || (adr==1 && adc==2);
-        } else if (lower == 'b') {
-            return (adr==adc && adr>0 && pathClear(sr,sc,tr,tc));
-        } else if (lower == 'r') {
-            return ((adr==0 && adc>0) || (adr>0 && adc==0)) && pathClear(sr,sc,tr,tc);
-        } else if (lower == 'q') {
-            return (((adr==adc && adr>0) || (adr==0 && adc>0) || (adr>0 && adc==0)) && pathClear(sr,sc,tr,tc));
-        } else if (lower == 'k') {
-            if (std::max(adr,adc) == 1) return true;
-            if (adr==0 && adc==2) {
-                if (movingWhite) {
-                    if (wkMoved) return false;
-                    if (tc > sc) {
-                        if (b[7][7] != 'R') return false;
-                        if (b[7][5] != '.' || b[7][6] != '.') return false;
-                        return true;
-                    } else {
-                        if (b[7][0] != 'R') return false;
-                        if (b[7][1] != '.' || b[7][2] != '.' || b[7][3] != '.') return false;
-                        return true;
-                    }
-                } else {
-                    if (bkMoved) return false;
-                    if (tc > sc) {
-                        if (b[0][7] != 'r') return false;
-                        if (b[0][5] != '.' || b[0][6] != '.') return false;
-                        return true;
-                    } else {
-                        if (b[0][0] != 'r') return false;
-                        if (b[0][1] != '.' || b[0][2] != '.' || b[0][3] != '.') return false;
-                        return true;
-                    }
-                }
+            slices.push_back({i, from, to});
+            from = to;
+        }
+    }
+    // Each thread's share of --ram holds its position records and a small
+    // buffer of game refs; both spill to sorted runs when full.
+    static_assert(sizeof(DbRecord) == sizeof(DbGameRef), "records and refs share one budget");
+    const size_t perThread = std::max<size_t>(((size_t)ramMb << 20) / std::max(threads, 1) / sizeof(DbRecord), 1024);
+    const size_t refsPerThread = perThread / 32, recordsPerThread = perThread - refsPerThread;
+    std::atomic<size_t> nextSlice{0};
+    std::atomic<std::uint32_t> nextGame{0};
+    std::atomic<U64> positions{0}, badGames{0};
+    std::mutex runLock;
+    std::vector<std::string> runs, gameFiles;
+    bool writeFailed = false;
+    auto spill = [&](std::vector<DbRecord> &buf) {
+        std::sort(buf.begin(), buf.end());
+        std::lock_guard<std::mutex> guard(runLock);
+        std::string path = outPath + ".run" + std::to_string(runs.size());
+        writeFailed |= !writeRecords(path, buf.data(), buf.size());
+        runs.push_back(path);
+        buf.clear();
+    };
+    auto spillRefs = [&](std::vector<DbGameRef> &refs) {
+        std::sort(refs.begin(), refs.end());
+        std::lock_guard<std::mutex> guard(runLock);
+        std::string path = outPath + ".games" + std::to_string(gameFiles.size());
+        writeFailed |= !writeRecords(path, refs.data(), refs.size());
+        gameFiles.push_back(path);
+        refs.clear();
+    };
+    auto worker = [&]() {
+        std::vector<DbRecord> buf;
+        buf.reserve(recordsPerThread);
+        std::vector<DbGameRef> refs;
+        refs.reserve(refsPerThread);
+        auto g = std::make_unique<Game>();
+        PgnGameView view;
+        for (size_t s; (s = nextSlice++) < slices.size(); ) {
+            const Slice &slice = slices[s];
+            PgnReader reader(slice.begin, slice.end);
+            const char *fileStart = (const char *)files[slice.file]->data;
+            while (true) {
+                while (reader.pos < reader.end && std::isspace((unsigned char)*reader.pos)) ++reader.pos;
+                U64 offset = reader.pos - fileStart;
+                if (!reader.next(view)) break;
+                std::uint32_t id = nextGame++;
+                refs.push_back({id, (std::uint32_t)slice.file, offset});
+                if (refs.size() == refsPerThread) spillRefs(refs);
+                std::string_view res = view.tag("Result");
+                std::uint8_t result = res == "1-0" ? 0 : res == "1/2-1/2" ? 1 : res == "0-1" ? 2 : 3;
+                int plies = replayPgn(view, *g, [&](const Game &pos, Game::Move m) {
+                    buf.push_back({pos.key, id, m.data, result, 0});
+                    if (buf.size() == recordsPerThread) spill(buf);
+                });
+                if (plies < 0) ++badGames;
+                else positions += plies;
             }
+        }
+        if (!buf.empty()) spill(buf);
+        if (!refs.empty()) spillRefs(refs);
+    };
+    std::vector<std::thread> pool;
+    for (int t=1; t<threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto &th : pool) th.join();
+    double ingestSecs = secondsSince(t0);
+    if (writeFailed) { std::cerr << "Could not write temporary files next to " << outPath << "\n"; return 1; }
+
+    // Merge the runs into key, index, posting and summary streams. Every
+    // write is checked: a short database would otherwise pass for a whole
+    // one.
+    auto t1 = std::chrono::steady_clock::now();
+    static const char *const parts[7] = {".keys", ".pidx", ".sidx", ".post", ".stat", ".gref", ".name"};
+    auto cleanUp = [&]() {
+        for (const std::string &p : runs) std::remove(p.c_str());
+        for (const std::string &p : gameFiles) std::remove(p.c_str());
+        for (const char *part : parts) std::remove((outPath + part).c_str());
+    };
+    auto fail = [&](const std::string &what) {
+        std::cerr << "Could not write " << what << "\n";
+        cleanUp();
+        return 1;
+    };
+    FILE *out[7] = {};
+    auto closeAll = [&]() {
+        bool ok = true;
+        for (FILE *&f : out) {
+            if (f && std::fclose(f) != 0) ok = false;
+            f = nullptr;
+        }
+        return ok;
+    };
+    for (int i=0; i<7; ++i) {
+        out[i] = std::fopen((outPath + parts[i]).c_str(), "wb");
+        if (!out[i]) { closeAll(); return fail(outPath + parts[i]); }
+    }
+    bool written = true;
+    auto put = [&](const void *data, size_t size, FILE *f) { written &= std::fwrite(data, size, 1, f) == 1; };
+    U64 keyCount = 0, postingCount = 0, statCount = 0;
+    bool haveKey = false;
+    U64 lastKey = 0;
+    DbMoveStats cur{};
+    auto flushStats = [&]() {
+        if (cur.games) { put(&cur, sizeof(cur), out[4]); ++statCount; }
+        cur = DbMoveStats{};
+    };
+    bool merged = mergeSortedFiles<DbRecord>(runs, outPath + ".mrun", (size_t)ramMb << 20, [&](const DbRecord &r) {
+        if (!haveKey || r.key != lastKey) {
+            flushStats();
+            put(&r.key, 8, out[0]);
+            put(&postingCount, 8, out[1]);
+            put(&statCount, 8, out[2]);
+            ++keyCount;
+            haveKey = true;
+            lastKey = r.key;
+        } else if (r.move != cur.move) flushStats();
+        cur.move = r.move;
+        ++cur.games;
+        ++cur.results[r.result];
+        DbPosting p{r.game, r.move, r.result, 0};
+        put(&p, sizeof(p), out[3]);
+        ++postingCount;
+    });
+    flushStats();
+    put(&postingCount, 8, out[1]);
+    put(&statCount, 8, out[2]);
+    merged = merged && mergeSortedFiles<DbGameRef>(gameFiles, outPath + ".mgame", (size_t)ramMb << 20,
+                                                   [&](const DbGameRef &r) { put(&r, sizeof(r), out[5]); });
+    for (const std::string &in : inputs) put(in.c_str(), in.size() + 1, out[6]);
+    if (!closeAll() || !written || !merged) return fail("temporary files next to " + outPath);
+
+    FILE *db = std::fopen(outPath.c_str(), "wb");
+    if (!db) return fail(outPath);
+    DbHeader h{};
+    std::memcpy(h.magic, dbMagic, 8);
+    h.positions = keyCount;
+    h.postings = postingCount;
+    h.stats = statCount;
+    h.games = nextGame;
+    h.files = inputs.size();
+    bool ok = std::fwrite(&h, sizeof(h), 1, db) == 1;
+    U64 *sections[7] = {&h.keysAt, &h.postingIndexAt, &h.statsIndexAt, &h.postingsAt, &h.statsAt, &h.gamesAt, &h.namesAt};
+    for (int i=0; i<7 && ok; ++i) ok = appendFile(db, outPath + parts[i], *sections[i]);
+    ok = ok && std::fseek(db, 0, SEEK_SET) == 0 && std::fwrite(&h, sizeof(h), 1, db) == 1;
+    ok = (std::fclose(db) == 0) && ok;
+    if (!ok) {
+        std::remove(outPath.c_str());
+        return fail(outPath);
+    }
+    cleanUp();
+
+    double mergeSecs = secondsSince(t1), secs = secondsSince(t0);
+    std::cout << h.games << " games (" << badGames << " with bad moves), " << positions << " positions, "
+              << keyCount << " distinct, from " << inputs.size() << " files\n"
+              << "Ingest " << ingestSecs << " s on " << threads << " threads into " << runs.size()
+              << " runs, merge " << mergeSecs << " s, total " << secs << " s ("
+              << (U64)(h.games / std::max(secs, 1e-9)) << " games/s)\n"
+              << outPath << ": " << fileSize(outPath) << " bytes, RAM budget " << ramMb << " MB\n";
+    return 0;
+}
+
+struct GameDb {
+    MappedFile file;
+    DbHeader header{};
+    const U64 *keys = nullptr, *postingIndex = nullptr, *statsIndex = nullptr;
+    const DbPosting *postings = nullptr;
+    const DbMoveStats *stats = nullptr;
+    const DbGameRef *games = nullptr;
+    std::vector<std::string> names;
+
+    bool open(const std::string &path) {
+        if (!file.open(path) || file.size < sizeof(DbHeader)) return false;
+        std::memcpy(&header, file.data, sizeof(header));
+        if (std::memcmp(header.magic, dbMagic, 8) != 0) return false;
+        // Every section has to lie inside the file.
+        auto fits = [&](U64 at, U64 count, U64 size) { return at <= file.size && count <= (file.size - at) / size; };
+        if (!fits(header.keysAt, header.positions, 8) || !fits(header.postingIndexAt, header.positions + 1, 8) ||
+            !fits(header.statsIndexAt, header.positions + 1, 8) ||
+            !fits(header.postingsAt, header.postings, sizeof(DbPosting)) ||
+            !fits(header.statsAt, header.stats, sizeof(DbMoveStats)) ||
+            !fits(header.gamesAt, header.games, sizeof(DbGameRef)) || header.namesAt > file.size)
             return false;
+        keys = (const U64 *)(file.data + header.keysAt);
+        postingIndex = (const U64 *)(file.data + header.postingIndexAt);
+        statsIndex = (const U64 *)(file.data + header.statsIndexAt);
+        postings = (const DbPosting *)(file.data + header.postingsAt);
+        stats = (const DbMoveStats *)(file.data + header.statsAt);
+        games = (const DbGameRef *)(file.data + header.gamesAt);
+        const char *p = (const char *)file.data + header.namesAt, *end = (const char *)file.data + file.size;
+        for (U64 i=0; i<header.files && p < end; ++i) {
+            names.emplace_back(p);
+            p += names.back().size() + 1;
         }
-        return false;
+        return true;
     }
 
-    bool makeMoveIfLegal(int sr,int sc,int tr,int tc, char promo = 0) {
-        if (!pseudoLegal(sr,sc,tr,tc,promo)) return false;
-        Game copy = *this;
-        char moving = copy.b[sr][sc];
-        char lower = std::tolower((unsigned char)moving);
-        bool movingWhite = isWhite(moving);
-        copy.enPassant = {-1,-1};
-
-        if (lower=='k' && sr== (movingWhite?7:0) && std::abs(tc-sc)==2) {
-            copy.b[sr][sc] = '.';
-            copy.b[tr][tc] = moving;
-            if (movingWhite) {
-                if (tc>sc) { copy.b[7][7] = '.'; copy.b[7][5] = 'R'; }
-                else { copy.b[7][0] = '.'; copy.b[7][3] = 'R'; }
-                copy.wkMoved = true;
-            } else {
-                if (tc>sc) { copy.b[0][7] = '.'; copy.b[0][5] = 'r'; }
-                else { copy.b[0][0] = '.'; copy.b[0][3] = 'r'; }
-                copy.bkMoved = true;
-            }
-        } else {
-            if (lower=='p' && sc!=tc && copy.b[tr][tc]=='.' && copy.enPassant.first==tr && copy.enPassant.second==tc) {
-                int capr = movingWhite ? tr+1 : tr-1;
-                copy.b[capr][tc] = '.';
-            }
-            copy.b[tr][tc] = copy.b[sr][sc];
-            copy.b[sr][sc] = '.';
-            if (lower=='p' && std::abs(tr-sr)==2) {
-                int epR = (sr + tr)/2;
-                copy.enPassant = {epR, sc};
-            }
-            if (lower=='p') {
-                if (movingWhite && tr==0) {
-                    char p = promo ? std::toupper(promo) : 'Q';
-                    copy.b[tr][tc] = p;
-                } else if (!movingWhite && tr==7) {
-                    char p = promo ? std::tolower(promo) : 'q';
-                    copy.b[tr][tc] = p;
-                }
-            }
-            if (lower=='k') {
-                if (movingWhite) copy.wkMoved = true; else copy.bkMoved = true;
+    // Index of a position's key, or -1.
+    long long find(U64 key) const {
+        const U64 *it = std::lower_bound(keys, keys + header.positions, key);
+        return it != keys + header.positions && *it == key ? it - keys : -1;
+    }
+};
+
+// Lists what was played from a position and how it scored, with lookup
+// latency and a few of the games.
+static int runDbExplore(const std::string &path, const std::string &fen) {
+    auto db = std::make_unique<GameDb>();
+    auto t0 = std::chrono::steady_clock::now();
+    if (!db->open(path)) { std::cerr << "Could not open database " << path << "\n"; return 1; }
+    double openUs = secondsSince(t0) * 1e6;
+    auto g = std::make_unique<Game>();
+    if (!fen.empty() && !g->setFen(fen)) { std::cerr << "Bad FEN: " << fen << "\n"; return 1; }
+    // Latency over stored keys picked at random, so most lookups miss the cache.
+    const int lookups = 100000;
+    std::mt19937_64 rng(1);
+    volatile U64 sink = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (int i=0; i<lookups && db->header.positions; ++i) {
+        long long k = db->find(db->keys[rng() % db->header.positions]);
+        for (U64 s=db->statsIndex[k]; s<db->statsIndex[k+1]; ++s) sink = sink + db->stats[s].games;
+    }
+    double lookupUs = secondsSince(t0) * 1e6 / lookups;
+    std::cout << db->header.games << " games, " << db->header.positions << " positions; opened in " << openUs
+              << " us, random lookup " << lookupUs << " us\n";
+    long long k = db->find(g->key);
+    if (k < 0) { std::cout << "Position not in database\n"; return 0; }
+    std::vector<DbMoveStats> moves(db->stats + db->statsIndex[k], db->stats + db->statsIndex[k+1]);
+    std::sort(moves.begin(), moves.end(), [](const DbMoveStats &a, const DbMoveStats &b) { return a.games > b.games; });
+    U64 total = 0;
+    for (const DbMoveStats &m : moves) total += m.games;
+    std::cout << total << " games reached this position\n";
+    bool white = g->whiteToMove;
+    for (const DbMoveStats &m : moves) {
+        Game::Move mv;
+        mv.data = m.move;
+        double score = (m.results[white ? 0 : 2] + 0.5 * m.results[1]) / std::max(m.games - m.results[3], 1u);
+        std::cout << std::setw(8) << toSan(*g, mv) << std::setw(9) << m.games << "  score " << std::setw(5)
+                  << (int)std::lround(score * 100) << "%  +" << m.results[white ? 0 : 2] << " =" << m.results[1]
+                  << " -" << m.results[white ? 2 : 0] << "\n";
+    }
+    // A few sample games, read back from their source files.
+    U64 first = db->postingIndex[k], last = std::min(db->postingIndex[k+1], first + 5);
+    for (U64 i=first; i<last; ++i) {
+        const DbGameRef &ref = db->games[db->postings[i].game];
+        std::string source = ref.file < db->names.size() ? db->names[ref.file] : "?";
+        MappedFile pgn;
+        PgnGameView view;
+        if (pgn.open(source) && ref.offset < pgn.size) {
+            PgnReader reader((const char *)pgn.data + ref.offset, (const char *)pgn.data + pgn.size);
+            if (reader.next(view)) {
+                std::cout << "  " << view.tag("White") << " - " << view.tag("Black") << "  " << view.tag("Result")
+                          << "  (" << source << " @" << ref.offset << ")\n";
+                continue;
             }
-            if (lower=='r') {
-                if (movingWhite) {
-                    if (sr==7 && sc==7) copy.wkMoved = true;
-                    if (sr==7 && sc==0) copy.wqMoved = true;
-                } else {
-                    if (sr==0 && sc==7) copy.bkMoved = true;
-                    if (sr==0 && sc==0) copy.bqMoved = true;
-                }
+        }
+        std::cout << "  game " << db->postings[i].game << " (" << source << " @" << ref.offset << ")\n";
+    }
+    return 0;
+}
+
+// ------------------------------------------------------
+// Game analysis
+// ------------------------------------------------------
+// Every position of a game gets a fixed-time search. The positions are
+// independent, so workers pull them from a shared counter and wall time
+// falls with the thread count. Each worker replays the game up to the
+// positions it takes, so searches see the game's history and score
+// repetitions as draws, and keeps its share of the hash from one position
+// to the next. A move's cost is
+// the drop from the score before it to the negated score after it, with
+// mate scores capped so that a slower mate is not a blunder.
+struct PlyAnalysis {
+    Game::Move best;
+    int score = 0;            // side to move's view
+    int depth = 0;
+    bool searched = false;
+};
+
+static std::string formatEval(int whiteScore) {
+    if (whiteScore >= MATE_BOUND) return "#" + std::to_string((MATE_SCORE - whiteScore + 1) / 2);
+    if (whiteScore <= -MATE_BOUND) return "#-" + std::to_string((MATE_SCORE + whiteScore + 1) / 2);
+    char buf[16];
+    std::snprintf(buf, sizeof buf, "%+.2f", whiteScore / 100.0);
+    return buf;
+}
+
+static int analyzeGame(const std::string &startFen, const std::vector<Game::Move> &moves, int threads,
+                       int moveTimeMs, int hashMb) {
+    auto t0 = std::chrono::steady_clock::now();
+    auto g = std::make_unique<Game>();
+    if (!g->setFen(startFen)) { std::cerr << "Bad FEN: " << startFen << "\n"; return 1; }
+    std::vector<PlyAnalysis> plies(moves.size() + 1);
+    std::atomic<size_t> next{0};
+    std::atomic<U64> nodes{0};
+    std::mutex lock;
+    double searchSecs = 0;
+    auto worker = [&]() {
+        TranspositionTable tt(std::max(1, hashMb / std::max(threads, 1)));
+        auto pos = std::make_unique<Game>();
+        pos->setFen(startFen);
+        size_t at = 0;          // plies made on pos; the counter only goes up
+        for (size_t i; (i = next++) < plies.size(); ) {
+            while (at < i) pos->make(moves[at++]);
+            Game::MoveList legal;
+            pos->generateLegal(legal);
+            if (legal.size == 0) {
+                plies[i].score = pos->inCheck() ? -MATE_SCORE : 0;
+                continue;
             }
+            // The search from the previous position scored this as a draw.
+            if (i > 0 && (pos->halfmoves >= 100 || pos->isRepetition())) continue;
+            SearchLimits limits;
+            limits.timeMs = moveTimeMs;
+            SearchResult r = searchSmp(*pos, &tt, limits, 1);
+            plies[i] = {r.best, r.score, r.depth, true};
+            nodes += r.nodes;
+            std::lock_guard<std::mutex> guard(lock);
+            searchSecs += r.secs;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t=1; t<threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto &th : pool) th.join();
+    double secs = secondsSince(t0);
+
+    // Replay to annotate: NAGs after the move, then the evaluation and,
+    // for costly moves, the engine's choice.
+    const int clampCp = 1000;
+    auto clamp = [&](int s) { return std::max(-clampCp, std::min(clampCp, s)); };
+    int counts[2][3] = {}, lossSum[2] = {}, moved[2] = {};
+    std::string text, line;
+    auto emit = [&](const std::string &token) {
+        if (!line.empty() && line.size() + 1 + token.size() > 80) { text += line + "\n"; line.clear(); }
+        line += (line.empty() ? "" : " ") + token;
+    };
+    g->setFen(startFen);
+    for (size_t i=0; i<moves.size(); ++i) {
+        bool white = g->whiteToMove;
+        int side = white ? 0 : 1;
+        int loss = moves[i] == plies[i].best ? 0 : std::max(0, clamp(plies[i].score) - clamp(-plies[i+1].score));
+        lossSum[side] += loss;
+        ++moved[side];
+        int grade = loss >= 300 ? 0 : loss >= 100 ? 1 : loss >= 50 ? 2 : -1;
+        std::string san = toSan(*g, moves[i]);
+        if (white || i == 0) san = std::to_string(g->fullmoves) + (white ? ". " : "... ") + san;
+        if (grade >= 0) {
+            static const char *nag[3] = {"??", "?", "?!"};
+            san += nag[grade];
+            ++counts[side][grade];
         }
+        emit(san);
+        // Mate, stalemate and draws by repetition or the fifty-move rule need
+        // no evaluation after the move.
+        std::string comment = !plies[i+1].searched ? (plies[i+1].score ? "" : "draw")
+                                                   : formatEval(white ? -plies[i+1].score : plies[i+1].score);
+        if (grade >= 0 && plies[i].best.data)
+            comment += "; best " + toSan(*g, plies[i].best) + " " + formatEval(white ? plies[i].score : -plies[i].score);
+        if (!comment.empty()) emit("{" + comment + "}");
+        g->make(moves[i]);
+    }
+    std::cout << text << line << "\n\n";
+    for (int side=0; side<2; ++side)
+        std::cout << (side == 0 ? "White: " : "Black: ") << counts[side][0] << " blunders, " << counts[side][1]
+                  << " mistakes, " << counts[side][2] << " inaccuracies, average loss "
+                  << lossSum[side] / std::max(moved[side], 1) << " cp\n";
+    std::cout << plies.size() << " positions in " << secs << " s on " << threads << " threads (" << searchSecs
+              << " s of search, " << searchSecs / std::max(secs, 1e-9) << "x), " << nodes << " nodes\n";
+    return 0;
+}
 
-        int kr=-1,kc=-1;
-        if (!copy.findKing(movingWhite, kr, kc)) return false;
-        if (copy.isAttacked(kr,kc, !movingWhite)) return false;
+// Analyzes the n-th game (1-based) of a PGN file.
+static int runAnalyze(const std::string &path, int n, int threads, int moveTimeMs, int hashMb) {
+    MappedFile file;
+    if (!file.open(path)) { std::cerr << "Could not open " << path << "\n"; return 1; }
+    PgnReader reader((const char *)file.data, (const char *)file.data + file.size);
+    PgnGameView view;
+    for (int i=0; i<n; ++i)
+        if (!reader.next(view)) { std::cerr << path << " has fewer than " << n << " games\n"; return 1; }
+    auto g = std::make_unique<Game>();
+    std::vector<Game::Move> moves;
+    std::string startFen;
+    int plies = replayPgn(view, *g, [&](const Game &pos, Game::Move m) {
+        if (moves.empty()) startFen = pos.fen();
+        moves.push_back(m);
+    });
+    if (plies < 0) std::cerr << "Stopped at an illegal or unreadable move after " << moves.size() << " plies\n";
+    if (moves.empty()) { std::cerr << "No moves to analyze\n"; return 1; }
+    std::cout << "[White \"" << view.tag("White") << "\"]\n[Black \"" << view.tag("Black") << "\"]\n[Result \""
+              << view.tag("Result") << "\"]\n\n";
+    return analyzeGame(startFen, moves, threads, moveTimeMs, hashMb);
+}
 
-        history.push_back(snapshot());
-        if (history.size() > 2000) history.erase(history.begin());
-        *this = copy;
-        whiteToMove = !whiteToMove;
-        if (!whiteToMove) ++fullmoves;
+// ------------------------------------------------------
+// Self-play
+// ------------------------------------------------------
+// Engine A is the configured build; engine B differs by --weights-b and/or
+// --tc-b. Games run concurrently, one single-threaded search each, and every
+// opening is played twice with colours reversed.
+struct TimeControl {
+    int baseMs = 10000;
+    int incMs = 100;
+};
+
+// "base+inc" in seconds, e.g. "10+0.1"; the increment is optional.
+static bool parseTimeControl(const std::string &s, TimeControl &tc) {
+    std::istringstream in(s);
+    double base = 0, inc = 0;
+    char plus = 0;
+    if (!(in >> base)) return false;
+    if (in >> plus && (plus != '+' || !(in >> inc))) return false;
+    tc.baseMs = (int)(base * 1000);
+    tc.incMs = (int)(inc * 1000);
+    return tc.baseMs > 0 && tc.incMs >= 0;
+}
+
+// Short balanced openings used when no --openings file is given.
+static const char *selfplayOpenings[] = {
+    "e2e4 e7e5 g1f3 b8c6 f1b5 a7a6",
+    "e2e4 e7e5 g1f3 b8c6 f1c4 f8c5",
+    "e2e4 c7c5 g1f3 d7d6 d2d4 c5d4 f3d4 g8f6",
+    "e2e4 c7c5 b1c3 b8c6 g2g3",
+    "e2e4 e7e6 d2d4 d7d5 b1c3 g8f6",
+    "e2e4 c7c6 d2d4 d7d5 e4e5 c8f5",
+    "e2e4 d7d6 d2d4 g8f6 b1c3 g7g6",
+    "e2e4 d7d5 e4d5 d8d5 b1c3 d5a5",
+    "d2d4 d7d5 c2c4 e7e6 b1c3 g8f6",
+    "d2d4 d7d5 c2c4 c7c6 g1f3 g8f6",
+    "d2d4 g8f6 c2c4 g7g6 b1c3 f8g7 e2e4 d7d6",
+    "d2d4 g8f6 c2c4 e7e6 b1c3 f8b4",
+    "d2d4 g8f6 c2c4 e7e6 g1f3 b7b6",
+    "d2d4 f7f5 g2g3 g8f6 f1g2 g7g6",
+    "c2c4 e7e5 b1c3 g8f6 g2g3 d7d5",
+    "c2c4 c7c5 g1f3 b8c6 b1c3 g7g6",
+    "g1f3 d7d5 g2g3 g8f6 f1g2 c7c6",
+    "g1f3 g8f6 c2c4 b7b6 g2g3 c8b7",
+    "e2e4 e7e5 f2f4 e5f4 g1f3 g7g5",
+    "d2d4 d7d5 c1f4 g8f6 e2e3 c7c5",
+};
+
+// Opening FENs: one FEN or EPD per line from a file, or the built-in move
+// sequences played from the start position.
+static bool loadOpenings(const std::string &path, std::vector<std::string> &out) {
+    if (path.empty()) {
+        for (const char *line : selfplayOpenings) {
+            Game g;
+            std::istringstream in(line);
+            std::string mv;
+            Game::Move m;
+            while (in >> mv) if (g.findUci(mv, m)) g.make(m);
+            out.push_back(g.fen());
+        }
         return true;
     }
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string board, side, rights, ep;
+        if (!(fields >> board >> side >> rights >> ep) || board[0] == '#') continue;
+        Game g;
+        if (g.setFen(board + " " + side + " " + rights + " " + ep)) out.push_back(g.fen());
+    }
+    return !out.empty();
+}
 
-    struct Move { int sr,sc,tr,tc; char promo; };
-    std::vector<Move> legalMoves() const {
-        std::vector<Move> out;
-        for (int sr=0; sr<8; ++sr) for (int sc=0; sc<8; ++sc) {
-            char p = b[sr][sc];
-            if (p=='.') continue;
-            if (isWhite(p) != whiteToMove) continue;
-            for (int tr=0; tr<8; ++tr) for (int tc=0; tc<8; ++tc) {
-                if (!pseudoLegal(sr,sc,tr,tc)) continue;
-                if (std::tolower((unsigned char)p)=='p' && (tr==0 || tr==7)) {
-                    const char promos[] = {'q','r','b','n'};
-                    for (char pr : promos) {
-                        Game copy = *this;
-                        if (copy.makeMoveIfLegal(sr,sc,tr,tc,pr)) out.push_back({sr,sc,tr,tc,pr});
-                    }
-                } else {
-                    Game copy = *this;
-                    if (copy.makeMoveIfLegal(sr,sc,tr,tc,0)) out.push_back({sr,sc,tr,tc,0});
+struct SelfplayEngine {
+    const EvalNet *net = &evalNet;
+    TimeControl tc;
+};
+
+enum { RESULT_LOSS, RESULT_DRAW, RESULT_WIN };
+
+static bool insufficientMaterial(const Game &g) {
+    U64 majors = g.pieces[WP] | g.pieces[BP] | g.pieces[WR] | g.pieces[BR] | g.pieces[WQ] | g.pieces[BQ];
+    return !majors && popcount(g.occupied) <= 3;
+}
+
+// Plays one game and returns its result for engine A. Games end on mate,
+// the usual draw rules, a flag fall, a bitbase hit, or once both sides have
+// agreed on a decisive score for eight plies in a row.
+static int playSelfplayGame(const std::string &fen, const SelfplayEngine *engines, bool aWhite, int hashMb, U64 &nodes,
+                            std::vector<Game::Move> &moves) {
+    Game g;
+    g.setFen(fen);
+    std::unique_ptr<TranspositionTable> tt[2] = {
+        std::make_unique<TranspositionTable>(hashMb), std::make_unique<TranspositionTable>(hashMb)};
+    int clockMs[2] = {engines[0].tc.baseMs, engines[1].tc.baseMs};
+    int decisive = 0, lastSign = 0;
+    for (int ply=0; ; ++ply) {
+        int stm = g.whiteToMove ? WHITE : BLACK;
+        int e = (stm == WHITE) == aWhite ? 0 : 1;
+        auto forSideToMove = [&](int r) { return e == 0 ? r : RESULT_WIN - r; };
+        Game::MoveList list;
+        g.generateLegal(list);
+        if (list.size == 0) return g.inCheck() ? forSideToMove(RESULT_LOSS) : RESULT_DRAW;
+        if (g.halfmoves >= 100 || g.repetitionCount() >= 3 || insufficientMaterial(g) || ply >= 600)
+            return RESULT_DRAW;
+        int wdl;
+        if (bitbases.probe(g, wdl)) return forSideToMove(wdl + 1);
+
+        Game view = g;
+        view.setNet(engines[e].net);
+        SearchLimits limits;
+        limits.timeMs = std::max(1, std::min(clockMs[e] / 20 + engines[e].tc.incMs * 3 / 4, clockMs[e] / 2));
+        auto t0 = std::chrono::steady_clock::now();
+        SearchResult r = searchSmp(view, tt[e].get(), limits, 1);
+        clockMs[e] -= (int)(secondsSince(t0) * 1000);
+        if (clockMs[e] < 0) return forSideToMove(RESULT_LOSS);
+        clockMs[e] += engines[e].tc.incMs;
+        nodes += r.nodes;
+
+        int sign = r.score >= 1000 ? 1 : r.score <= -1000 ? -1 : 0;
+        if (stm == BLACK) sign = -sign;
+        decisive = sign != 0 && (decisive == 0 || sign == lastSign) ? decisive + 1 : 0;
+        lastSign = sign;
+        if (decisive >= 8) return (sign > 0) == aWhite ? RESULT_WIN : RESULT_LOSS;
+        moves.push_back(r.best);
+        g.make(r.best);
+    }
+}
+
+static double eloFromScore(double score) {
+    if (score == 0.5) return 0;
+    score = std::min(std::max(score, 1e-6), 1 - 1e-6);
+    return -400 * std::log10(1 / score - 1);
+}
+
+static double scoreFromElo(double elo) { return 1 / (1 + std::pow(10.0, -elo / 400)); }
+
+struct MatchStats {
+    int results[3] = {0, 0, 0};   // losses, draws, wins for engine A
+
+    int games() const { return results[0] + results[1] + results[2]; }
+    double score() const { return (results[RESULT_WIN] + 0.5 * results[RESULT_DRAW]) / std::max(games(), 1); }
+    // Per-game score variance. prior adds that many pseudo-games to each
+    // outcome so a one-sided start does not look like zero variance.
+    double variance(double prior = 0) const {
+        double w = results[RESULT_WIN] + prior, d = results[RESULT_DRAW] + prior, l = results[RESULT_LOSS] + prior;
+        double n = std::max(w + d + l, 1.0), s = (w + 0.5 * d) / n;
+        return (w * (1 - s) * (1 - s) + d * (0.5 - s) * (0.5 - s) + l * s * s) / n;
+    }
+    // Half-width of the 95% confidence interval, in Elo.
+    double eloMargin() const {
+        double sd = std::sqrt(variance() / std::max(games(), 1));
+        return (eloFromScore(score() + 1.96 * sd) - eloFromScore(score() - 1.96 * sd)) / 2;
+    }
+    // Log-likelihood ratio of H1 (elo1) against H0 (elo0), using the
+    // normal approximation to the game outcome distribution.
+    double llr(double elo0, double elo1) const {
+        double var = variance(0.5);
+        if (games() == 0) return 0;
+        double s0 = scoreFromElo(elo0), s1 = scoreFromElo(elo1);
+        return games() * (s1 - s0) * (2 * score() - s0 - s1) / (2 * var);
+    }
+};
+
+struct SprtConfig {
+    double elo0 = 0, elo1 = 5, alpha = 0.05, beta = 0.05;
+    double lower() const { return std::log(beta / (1 - alpha)); }
+    double upper() const { return std::log((1 - beta) / alpha); }
+};
+
+static int runSelfplay(int games, int threads, int hashMb, const std::vector<std::string> &openings,
+                       const SelfplayEngine *engines, const SprtConfig &sprt, const std::string &pgnPath) {
+    MatchStats stats;
+    std::mutex lock;
+    std::atomic<int> next{0};
+    std::atomic<bool> stop{false};
+    std::atomic<U64> nodes{0};
+    auto t0 = std::chrono::steady_clock::now();
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Self-play: " << games << " games, " << threads << " concurrent, "
+              << openings.size() << " openings, SPRT [" << sprt.elo0 << ", " << sprt.elo1 << "]\n";
+    auto worker = [&]() {
+        for (int i; !stop && (i = next++) < games; ) {
+            U64 n = 0;
+            bool aWhite = i % 2 == 0;
+            const std::string &fen = openings[(i / 2) % openings.size()];
+            std::vector<Game::Move> moves;
+            int r = playSelfplayGame(fen, engines, aWhite, hashMb, n, moves);
+            nodes += n;
+            std::lock_guard<std::mutex> guard(lock);
+            ++stats.results[r];
+            if (!pgnPath.empty()) {
+                const char *result = r == RESULT_DRAW ? "1/2-1/2" : (r == RESULT_WIN) == aWhite ? "1-0" : "0-1";
+                appendPgn(pgnPath, {{"Event", "Self-play"}, {"Site", "?"}, {"Date", "????.??.??"},
+                                    {"Round", std::to_string(i + 1)}, {"White", aWhite ? "A" : "B"},
+                                    {"Black", aWhite ? "B" : "A"}, {"Result", result}}, fen, moves, result);
+            }
+            double llr = stats.llr(sprt.elo0, sprt.elo1);
+            std::cout << "Game " << stats.games() << ": +" << stats.results[RESULT_WIN] << " ="
+                      << stats.results[RESULT_DRAW] << " -" << stats.results[RESULT_LOSS]
+                      << "  Elo " << eloFromScore(stats.score()) << " +/- " << stats.eloMargin()
+                      << "  LLR " << llr << " [" << sprt.lower() << ", " << sprt.upper() << "]  "
+                      << stats.games() * 60 / secondsSince(t0) << " games/min\n";
+            if (llr <= sprt.lower() || llr >= sprt.upper()) stop = true;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t=1; t<threads; ++t) pool.emplace_back(worker);
+    worker();
+    for (auto &th : pool) th.join();
+    double secs = secondsSince(t0), llr = stats.llr(sprt.elo0, sprt.elo1);
+    std::cout << "Finished " << stats.games() << " games in " << secs << " s ("
+              << stats.games() * 60 / secs << " games/min, " << (U64)(nodes / std::max(secs, 1e-9)) << " nps)\n"
+              << "Elo difference: " << eloFromScore(stats.score()) << " +/- " << stats.eloMargin() << "\n"
+              << "SPRT: " << (llr >= sprt.upper() ? "H1 accepted" : llr <= sprt.lower() ? "H0 accepted" : "inconclusive")
+              << " (LLR " << llr << ")\n";
+    return 0;
+}
+
+// ------------------------------------------------------
+// UCI
+// ------------------------------------------------------
+// Headless engine mode. The main thread does nothing but read stdin, so
+// isready and stop are answered while the search runs on its own thread,
+// and the search sees stop within 1024 nodes.
+static std::mutex uciOutput;
+
+static void uciSend(const std::string &line) {
+    std::lock_guard<std::mutex> guard(uciOutput);
+    std::cout << line << std::endl;
+}
+
+static std::string uciInfo(const SearchResult &r) {
+    std::string s = "info depth " + std::to_string(r.depth) + " score " + formatScore(r.score)
+                  + " nodes " + std::to_string(r.nodes) + " nps " + std::to_string(r.nps())
+                  + " time " + std::to_string((U64)(r.secs * 1000)) + " pv";
+    for (Game::Move m : r.pv) s += " " + m.uci();
+    return s;
+}
+
+struct UciEngine {
+    Game game;
+    int hashMb = 16, threads = 1;
+    std::unique_ptr<TranspositionTable> tt;
+    SearchControl control;
+    std::thread searcher;
+    std::mutex waitLock;
+    std::condition_variable wake;
+
+    UciEngine(int hash, int threadCount) : hashMb(hash), threads(threadCount) {
+        tt = std::make_unique<TranspositionTable>(hashMb);
+    }
+    ~UciEngine() { stop(); }
+
+    // Wakes a finished infinite or pondering search so it reports.
+    void signal(bool stopSearch) {
+        {
+            std::lock_guard<std::mutex> guard(waitLock);
+            if (stopSearch) control.stop = true;
+            control.pondering = false;
+        }
+        wake.notify_all();
+    }
+
+    void stop() {
+        if (!searcher.joinable()) return;
+        signal(true);
+        searcher.join();
+    }
+
+    // position [startpos | fen <fen>] [moves <m1> ...]
+    void position(std::istringstream &in) {
+        std::string word, fen;
+        in >> word;
+        if (word == "fen") {
+            while (in >> word && word != "moves") fen += (fen.empty() ? "" : " ") + word;
+            if (!game.setFen(fen)) game.reset();
+        } else {
+            game.reset();
+            in >> word;
+        }
+        Game::Move m;
+        while (in >> word && game.findUci(word, m)) game.make(m);
+    }
+
+    void go(std::istringstream &in) {
+        int times[2] = {-1, -1}, incs[2] = {0, 0}, movesToGo = 0, moveTime = 0;
+        bool infinite = false, ponder = false;
+        SearchLimits limits;
+        limits.timeMs = 0;
+        std::string word;
+        while (in >> word) {
+            if (word == "wtime") in >> times[WHITE];
+            else if (word == "btime") in >> times[BLACK];
+            else if (word == "winc") in >> incs[WHITE];
+            else if (word == "binc") in >> incs[BLACK];
+            else if (word == "movestogo") in >> movesToGo;
+            else if (word == "movetime") in >> moveTime;
+            else if (word == "depth") in >> limits.maxDepth;
+            else if (word == "nodes") in >> limits.maxNodes;
+            else if (word == "infinite") infinite = true;
+            else if (word == "ponder") ponder = true;
+        }
+        int us = game.whiteToMove ? WHITE : BLACK;
+        if (moveTime > 0) limits.timeMs = moveTime;
+        else if (times[us] >= 0) {
+            int budget = times[us] / (movesToGo > 0 ? movesToGo + 1 : 30) + incs[us] * 3 / 4;
+            limits.timeMs = std::max(1, std::min(budget, times[us] / 2));
+        }
+        limits.maxDepth = std::min(std::max(limits.maxDepth, 1), MAX_PLY - 1);
+        limits.control = &control;
+        limits.onIteration = [](const SearchResult &r) { uciSend(uciInfo(r)); };
+        control.stop = false;
+        control.pondering = ponder;
+        searcher = std::thread([this, limits, infinite]() {
+            SearchResult r = searchSmp(game, tt.get(), limits, threads);
+            // In infinite and ponder mode bestmove must wait for the GUI.
+            {
+                std::unique_lock<std::mutex> lock(waitLock);
+                wake.wait(lock, [&]() { return control.stop || (!infinite && !control.pondering); });
+            }
+            uciSend(uciInfo(r));
+            std::string line = "bestmove " + (r.best.data ? r.best.uci() : std::string("0000"));
+            if (r.pv.size() >= 2) line += " ponder " + r.pv[1].uci();
+            uciSend(line);
+        });
+    }
+
+    int run() {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            std::istringstream in(line);
+            std::string cmd;
+            in >> cmd;
+            if (cmd == "uci") {
+                uciSend("id name ASYS Chess\nid author Taterraster\n"
+                        "option name Hash type spin default " + std::to_string(hashMb) + " min 1 max 65536\n"
+                        "option name Threads type spin default " + std::to_string(threads) + " min 1 max 512\n"
+                        "option name Ponder type check default false\nuciok");
+            } else if (cmd == "isready") uciSend("readyok");
+            else if (cmd == "ucinewgame") { stop(); tt->clear(); game.reset(); }
+            else if (cmd == "setoption") {
+                stop();
+                std::string word, name, value;
+                in >> word >> name >> word >> value;
+                if (name == "Hash" && std::atoi(value.c_str()) > 0) {
+                    hashMb = std::atoi(value.c_str());
+                    tt = std::make_unique<TranspositionTable>(hashMb);
                 }
+                if (name == "Threads" && std::atoi(value.c_str()) > 0) threads = std::atoi(value.c_str());
             }
+            else if (cmd == "position") { stop(); position(in); }
+            else if (cmd == "go") { stop(); go(in); }
+            else if (cmd == "stop") stop();
+            else if (cmd == "ponderhit") signal(false);
+            else if (cmd == "quit") break;
         }
-        return out;
+        stop();
+        return 0;
+    }
+};
+
+// ------------------------------------------------------
+// Command line
+// ------------------------------------------------------
+struct Options {
+    int threads = 0;  // 0 = one per hardware thread
+    int hashMb = 0;          // 0 = perft table off, 16 MB search table
+    std::string weights;     // NNUE weights file; piece-square tables if empty
+    std::string book;        // Polyglot opening book for the search AI
+    std::string bookKeys;    // Zobrist table matching the book's keys
+    std::string bitbaseDir;  // directory with kqk.bb, krk.bb, kpk.bb, kbnk.bb
+    std::string weightsB;    // self-play: engine B's network
+    std::string openings;    // self-play: FEN/EPD start positions
+    std::string tc, tcB;     // self-play: "base+inc" seconds for A and B
+    std::string sprt;        // self-play: "elo0,elo1"
+    std::string pgn;         // finished games are appended here
+    bool ponder = true;      // search the expected reply during the human's turn
+    bool uci = false;        // run as a UCI engine on stdin/stdout
+    std::string ai;          // "random" or "search" skips the opponent prompt
+    int moveTimeMs = 1000;   // search AI budget per move
+    int ramMb = 256;         // db-build: memory for sorting before spilling to disk
+    std::vector<std::string> args; // everything that is not an --option
+    int threadCount() const {
+        return threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
     }
 };
 
+static Options parseOptions(int argc, char **argv) {
+    Options opt;
+    for (int i=1; i<argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--threads" && hasValue) opt.threads = std::atoi(argv[++i]);
+        else if (a == "--hash" && hasValue) opt.hashMb = std::atoi(argv[++i]);
+        else if (a == "--ai" && hasValue) opt.ai = argv[++i];
+        else if (a == "--weights" && hasValue) opt.weights = argv[++i];
+        else if (a == "--book" && hasValue) opt.book = argv[++i];
+        else if (a == "--book-keys" && hasValue) opt.bookKeys = argv[++i];
+        else if (a == "--bitbases" && hasValue) opt.bitbaseDir = argv[++i];
+        else if (a == "--weights-b" && hasValue) opt.weightsB = argv[++i];
+        else if (a == "--openings" && hasValue) opt.openings = argv[++i];
+        else if (a == "--tc" && hasValue) opt.tc = argv[++i];
+        else if (a == "--tc-b" && hasValue) opt.tcB = argv[++i];
+        else if (a == "--sprt" && hasValue) opt.sprt = argv[++i];
+        else if (a == "--pgn" && hasValue) opt.pgn = argv[++i];
+        else if (a == "--uci") opt.uci = true;
+        else if (a == "--ponder" && hasValue) opt.ponder = std::string(argv[++i]) != "off";
+        else if (a == "--movetime" && hasValue) opt.moveTimeMs = std::atoi(argv[++i]);
+        else if (a == "--ram" && hasValue) opt.ramMb = std::max(1, std::atoi(argv[++i]));
+        else opt.args.push_back(a);
+    }
+    return opt;
+}
+
+static int searchHashMb(const Options &opt) {
+    return opt.hashMb > 0 ? opt.hashMb : 16;
+}
+
+// Joins args[from..] back into one string, so a FEN can be passed unquoted.
+static std::string joinArgs(const std::vector<std::string> &args, size_t from) {
+    std::string out;
+    for (size_t i=from; i<args.size(); ++i) out += (out.empty() ? "" : " ") + args[i];
+    return out;
+}
+
+static void printUsage() {
+    std::cout << "Usage: chess [command] [options]\n"
+              << "  (no command)             interactive game\n"
+              << "  --uci                    UCI engine on stdin/stdout\n"
+              << "  perft <depth> [fen]      count leaf nodes\n"
+              << "  divide <depth> [fen]     perft split by root move\n"
+              << "  perft-suite              check the generator against reference counts\n"
+              << "  bench [depth]            fixed-depth search speed and node signature\n"
+              << "  smp-bench [depth]        time-to-depth speedup for 1..--threads threads\n"
+              << "  book [fen]               list --book moves for a position\n"
+              << "  bitbase-gen [dir]        build KQK/KRK/KPK/KBNK bitbases (default: --bitbases or .)\n"
+              << "  bitbase <fen>            probe the --bitbases tables\n"
+              << "  selfplay [games]         engine A vs B on all threads with SPRT (default 1000)\n"
+              << "  pgn-replay <file>        parse and replay every game of a PGN file\n"
+              << "  pgn-suite                check the PGN parser against malformed movetext\n"
+              << "  epd-solve <file>         search each EPD position for --movetime, check bm/am\n"
+              << "  solve-mate <n> <fen|file> df-pn mate-in-n proof (--movetime per puzzle,\n"
+              << "                           --hash MB table, default 64; files may set dm n)\n"
+              << "  db-build <db> <pgn...>   index every position of the PGN files (--ram MB, default 256)\n"
+              << "  db <db> [fen]            moves played from a position and how they scored\n"
+              << "  analyze <pgn> [n]        annotate game n (default 1), --movetime per position\n"
+              << "Options: --threads N, --hash MB, --ai random|search, --movetime MS, --weights FILE,\n"
+              << "         --book FILE (requires --book-keys FILE: 781 big-endian Polyglot Random64 keys),\n"
+              << "         --bitbases DIR, --pgn FILE (append finished games), --ponder on|off\n"
+              << "Self-play: --tc S+INC (default 10+0.1), --tc-b S+INC, --weights-b FILE,\n"
+              << "           --openings FILE, --sprt ELO0,ELO1 (default 0,5)\n";
+}
+
+static int runCommand(const Options &opt) {
+    const std::string &cmd = opt.args[0];
+    // Only the perft commands use the table; don't pay for --hash MB elsewhere.
+    auto makePerftTable = [&]() {
+        std::unique_ptr<PerftTable> table;
+        if (opt.hashMb > 0) table = std::make_unique<PerftTable>(opt.hashMb);
+        return table;
+    };
+    if (cmd == "perft" || cmd == "divide") {
+        if (opt.args.size() < 2) { printUsage(); return 1; }
+        int depth = std::atoi(opt.args[1].c_str());
+        std::string fen = joinArgs(opt.args, 2);
+        Game g;
+        if (!fen.empty() && !g.setFen(fen)) { std::cerr << "Bad FEN: " << fen << "\n"; return 1; }
+        Game::MoveList moves;
+        std::vector<U64> counts;
+        std::unique_ptr<PerftTable> perftTable = makePerftTable();
+        auto start = std::chrono::steady_clock::now();
+        U64 nodes = perftRoot(g, depth, opt.threadCount(), perftTable.get(), moves, counts);
+        double secs = secondsSince(start);
+        if (cmd == "divide")
+            for (int i=0; i<moves.size; ++i) std::cout << moves.moves[i].uci() << ": " << counts[i] << "\n";
+        std::cout << "perft " << depth << ": ";
+        printNodeRate(nodes, secs);
+        return 0;
+    }
+    if (cmd == "pgn-suite") return runPgnSuite();
+    if (cmd == "perft-suite") return runPerftSuite(opt.threadCount(), makePerftTable().get());
+    if (cmd == "smp-bench")
+        return runSmpBench(opt.args.size() > 1 ? std::atoi(opt.args[1].c_str()) : 8, opt.threadCount(), searchHashMb(opt));
+    if (cmd == "book") return runBookInfo(opt.book, joinArgs(opt.args, 1));
+    std::string bitbaseDir = opt.bitbaseDir.empty() ? "." : opt.bitbaseDir;
+    if (cmd == "bitbase-gen") return runBitbaseGen(opt.args.size() > 1 ? opt.args[1] : bitbaseDir, opt.threadCount());
+    if (cmd == "bitbase") return runBitbaseProbe(bitbaseDir, joinArgs(opt.args, 1));
+    if (cmd == "pgn-replay" || cmd == "epd-solve") {
+        if (opt.args.size() < 2) { printUsage(); return 1; }
+        if (cmd == "pgn-replay") return runPgnReplay(opt.args[1], opt.threadCount());
+        return runEpdSolve(opt.args[1], opt.threadCount(), opt.moveTimeMs, searchHashMb(opt));
+    }
+    if (cmd == "solve-mate") {
+        if (opt.args.size() < 3) { printUsage(); return 1; }
+        return runSolveMate(std::atoi(opt.args[1].c_str()), joinArgs(opt.args, 2), opt.moveTimeMs,
+                            opt.hashMb > 0 ? opt.hashMb : 64);
+    }
+    if (cmd == "db-build") {
+        if (opt.args.size() < 3) { printUsage(); return 1; }
+        return runDbBuild(opt.args[1], std::vector<std::string>(opt.args.begin() + 2, opt.args.end()),
+                          opt.threadCount(), opt.ramMb);
+    }
+    if (cmd == "analyze") {
+        if (opt.args.size() < 2) { printUsage(); return 1; }
+        return runAnalyze(opt.args[1], opt.args.size() > 2 ? std::max(1, std::atoi(opt.args[2].c_str())) : 1,
+                          opt.threadCount(), opt.moveTimeMs, searchHashMb(opt));
+    }
+    if (cmd == "db") {
+        if (opt.args.size() < 2) { printUsage(); return 1; }
+        return runDbExplore(opt.args[1], joinArgs(opt.args, 2));
+    }
+    if (cmd == "selfplay") {
+        static EvalNet netB;
+        SelfplayEngine engines[2];
+        if (!opt.tc.empty() && !parseTimeControl(opt.tc, engines[0].tc)) { std::cerr << "Bad --tc " << opt.tc << "\n"; return 1; }
+        engines[1].tc = engines[0].tc;
+        if (!opt.tcB.empty() && !parseTimeControl(opt.tcB, engines[1].tc)) { std::cerr << "Bad --tc-b " << opt.tcB << "\n"; return 1; }
+        if (!opt.weightsB.empty()) {
+            if (!netB.load(opt.weightsB)) { std::cerr << "Could not load " << opt.weightsB << "\n"; return 1; }
+            engines[1].net = &netB;
+        }
+        SprtConfig sprt;
+        if (!opt.sprt.empty() && std::sscanf(opt.sprt.c_str(), "%lf,%lf", &sprt.elo0, &sprt.elo1) != 2) {
+            std::cerr << "Bad --sprt " << opt.sprt << "\n";
+            return 1;
+        }
+        std::vector<std::string> openings;
+        if (!loadOpenings(opt.openings, openings)) { std::cerr << "Could not read openings " << opt.openings << "\n"; return 1; }
+        int games = opt.args.size() > 1 ? std::atoi(opt.args[1].c_str()) : 1000;
+        return runSelfplay(games, opt.threadCount(), opt.hashMb > 0 ? opt.hashMb : 4, openings, engines, sprt, opt.pgn);
+    }
+    if (cmd == "bench") return runBench(opt.args.size() > 1 ? std::atoi(opt.args[1].c_str()) : 6, searchHashMb(opt));
+    printUsage();
+    return cmd == "help" || cmd == "--help" ? 0 : 1;
+}
+
 static bool parseMoveStr(const std::string &in, int &sr,int &sc,int &tr,int &tc,char &promo) {
     std::string s;
     for (char ch : in) if (!std::isspace((unsigned char)ch)) s.push_back(ch);
@@ -308,64 +3874,131 @@ static bool parseMoveStr(const std::string &in, int &sr,int &sc,int &tr,int &tc,
     return true;
 }
 
-static Game::Move pickRandom(const std::vector<Game::Move> &moves) {
+static Game::Move pickRandom(const Game::MoveList &moves) {
     static std::mt19937 rng((unsigned)std::chrono::steady_clock::now().time_since_epoch().count());
-    std::uniform_int_distribution<size_t> d(0, moves.size()-1);
-    return moves[d(rng)];
+    std::uniform_int_distribution<int> d(0, moves.size-1);
+    return moves.moves[d(rng)];
 }
 
-int main(){
+int main(int argc, char **argv){
+    Options opt = parseOptions(argc, argv);
+    // Book entries are keyed with Polyglot's Random64 table; our own keys
+    // would never match one, so a book is useless without that table.
+    if (!opt.book.empty() && opt.bookKeys.empty()) {
+        std::cerr << "--book needs --book-keys (Polyglot's Random64 table) to match book entries\n";
+        return 1;
+    }
+    if (!opt.bookKeys.empty() && !loadZobristKeys(opt.bookKeys)) {
+        std::cerr << "Could not load book keys from " << opt.bookKeys << "\n";
+        return 1;
+    }
+    bool generating = !opt.args.empty() && opt.args[0] == "bitbase-gen";
+    if (!opt.bitbaseDir.empty() && !generating && bitbases.load(opt.bitbaseDir) == 0)
+        std::cerr << "No bitbases found in " << opt.bitbaseDir << "\n";
+    if (!opt.weights.empty() && !evalNet.load(opt.weights)) {
+        std::cerr << "Could not load weights from " << opt.weights << "\n";
+        return 1;
+    }
+    if (opt.uci) {
+        std::ios::sync_with_stdio(false);
+        return std::make_unique<UciEngine>(searchHashMb(opt), opt.threads > 0 ? opt.threads : 1)->run();
+    }
+    if (!opt.args.empty()) return runCommand(opt);
+
     Game g;
-    bool autoPlayBlack = false;
+    std::string ai = opt.ai;
     std::cout << "Console Chess (castling, en-passant, promotion, undo). Type 'help'.\n";
-    std::cout << "Play vs random AI? (y/N): ";
-    std::string yn; std::getline(std::cin, yn);
-    if (!yn.empty() && (yn[0]=='y' || yn[0]=='Y')) autoPlayBlack = true;
+    if (ai.empty()) {
+        std::cout << "Play vs computer? (N = no, r = random AI, s = search AI): ";
+        std::string yn; std::getline(std::cin, yn);
+        if (!yn.empty() && (yn[0]=='r' || yn[0]=='R' || yn[0]=='y' || yn[0]=='Y')) ai = "random";
+        if (!yn.empty() && (yn[0]=='s' || yn[0]=='S')) ai = "search";
+    }
+    bool autoPlayBlack = ai == "random" || ai == "search";
+    std::unique_ptr<TranspositionTable> tt;
+    if (ai == "search") tt = std::make_unique<TranspositionTable>(searchHashMb(opt));
+    Ponderer ponder;
+    Book book;
+    if (ai == "search" && !opt.book.empty() && !book.open(opt.book))
+        std::cout << "Could not open book " << opt.book << ", playing without it.\n";
 
+    // Annotates the moves played so far, searching each position for --movetime.
+    auto reviewGame = [&]() {
+        std::vector<Game::Move> played;
+        std::string startFen = gameRecord(g, played);
+        if (played.empty()) std::cout << "No moves to analyze.\n";
+        else analyzeGame(startFen, played, opt.threadCount(), opt.moveTimeMs, searchHashMb(opt));
+    };
+
+    std::string result = "*";
     while (true) {
         g.print();
-        int kr,kc;
-        g.findKing(g.whiteToMove, kr, kc);
-        bool inCheck = g.isAttacked(kr,kc, !g.whiteToMove);
-        auto moves = g.legalMoves();
-        if (moves.empty()) {
+        bool inCheck = g.inCheck();
+        Game::MoveList moves;
+        g.generateLegal(moves);
+        if (moves.size == 0) {
             if (inCheck) std::cout << (g.whiteToMove ? "Checkmate. Black wins.\n" : "Checkmate. White wins.\n");
             else std::cout << "Stalemate.\n";
+            result = !inCheck ? "1/2-1/2" : g.whiteToMove ? "0-1" : "1-0";
             break;
         }
+        if (g.repetitionCount() >= 3) { std::cout << "Draw by threefold repetition.\n"; result = "1/2-1/2"; break; }
+        if (g.halfmoves >= 100) { std::cout << "Draw by the fifty-move rule.\n"; result = "1/2-1/2"; break; }
         if (inCheck) std::cout << "Your king is in check!\n";
 
         if (!g.whiteToMove && autoPlayBlack) {
-            auto mv = pickRandom(moves);
-            char srcf = 'a' + mv.sc, dstf = 'a' + mv.tc;
-            int srank = 8 - mv.sr, trank = 8 - mv.tr;
-            std::cout << "Black plays " << srcf << srank << dstf << trank;
-            if (mv.promo) std::cout << mv.promo;
+            Game::Move mv;
+            auto replyStart = std::chrono::steady_clock::now();
+            bool ponderHit = ponder.finish(g);
+            if (ai == "search" && !ponderHit && book.count && book.pick(g, mv)) {
+                std::cout << "Black plays " << mv.uci() << "  (book)";
+            } else if (ai == "search") {
+                SearchLimits limits;
+                limits.timeMs = opt.moveTimeMs;
+                SearchResult r = ponderHit ? ponder.result : searchSmp(g, tt.get(), limits, opt.threadCount());
+                mv = r.best;
+                std::cout << "Black plays " << mv.uci() << "  (depth " << r.depth << ", " << formatScore(r.score)
+                          << ", " << r.nodes << " nodes, " << r.nps() << " nps";
+                if (ponderHit) std::cout << ", ponder hit, replied in " << secondsSince(replyStart) * 1000 << " ms";
+                std::cout << ")";
+                if (opt.ponder && r.pv.size() >= 2 && r.pv[0] == mv) {
+                    Game after = g;
+                    after.make(mv);
+                    ponder.start(after, r.pv[1], tt.get(), limits, opt.threadCount());
+                }
+            } else {
+                mv = pickRandom(moves);
+                std::cout << "Black plays " << mv.uci();
+            }
             std::cout << "\nPress Enter to continue..."; std::string tmp; std::getline(std::cin,tmp);
-            g.makeMoveIfLegal(mv.sr,mv.sc,mv.tr,mv.tc,mv.promo);
+            g.make(mv);
             continue;
         }
 
-        std::cout << "Enter move (e2e4), 'moves', 'undo', 'reset', 'resign' or 'quit': ";
+        std::cout << "Enter move (e2e4), 'moves', 'undo', 'redo', 'analyze', 'reset', 'resign' or 'quit': ";
         std::string line;
         std::getline(std::cin, line);
         if (line.empty()) continue;
-        if (line=="quit" || line=="resign") { std::cout << "Game ended.\n"; break; }
+        if (line=="quit" || line=="resign") {
+            if (line=="resign") result = g.whiteToMove ? "0-1" : "1-0";
+            std::cout << "Game ended.\n";
+            break;
+        }
         if (line=="help") {
-            std::cout << "Commands: move (e2e4), moves, undo, reset, resign/quit, help\n";
+            std::cout << "Commands: move (e2e4), moves, undo, redo, analyze, reset, resign/quit, help\n";
             std::cout << "Promotion: append q/r/b/n to move, e.g. e7e8q\n";
             std::cout << "Castling: e1g1 or e1c1 (white), e8g8 or e8c8 (black)\n";
+            std::cout << "SAN is accepted too: Nf3, exd5, O-O, e8=Q\n";
             std::cout << "En-passant supported automatically\n";
             std::cout << "Press Enter to continue..."; std::getline(std::cin,line); continue;
         }
         if (line=="moves") {
-            for (auto &m : moves) {
-                char sf = 'a' + m.sc, df = 'a' + m.tc;
-                int sr = 8 - m.sr, tr = 8 - m.tr;
-                std::cout << sf << sr << df << tr;
-                if (m.promo) std::cout << m.promo;
-                std::cout << '\n';
-            }
+            for (int i=0; i<moves.size; ++i) std::cout << moves.moves[i].uci() << '\n';
+            std::cout << "Press Enter..."; std::getline(std::cin,line);
+            continue;
+        }
+        if (line=="analyze") {
+            reviewGame();
             std::cout << "Press Enter..."; std::getline(std::cin,line);
             continue;
         }
@@ -374,13 +4007,35 @@ int main(){
             if (g.canUndo()) { g.undo(); continue; }
             else { std::cout << "Nothing to undo. Press Enter..."; std::getline(std::cin,line); continue; }
         }
+        if (line=="redo") {
+            if (g.canRedo()) { g.redo(); continue; }
+            else { std::cout << "Nothing to redo. Press Enter..."; std::getline(std::cin,line); continue; }
+        }
 
         int sr,sc,tr,tc; char promo=0;
-        if (!parseMoveStr(line, sr,sc,tr,tc,promo)) { std::cout << "Couldn't parse move. Press Enter..."; std::getline(std::cin,line); continue; }
+        if (!parseMoveStr(line, sr,sc,tr,tc,promo)) {
+            Game::Move san = parseSan(g, line);
+            if (san.data) { g.make(san); continue; }
+            std::cout << "Couldn't parse move. Press Enter..."; std::getline(std::cin,line); continue;
+        }
         if (!g.makeMoveIfLegal(sr,sc,tr,tc,promo)) { std::cout << "Illegal move. Press Enter..."; std::getline(std::cin,line); continue; }
     }
 
-    std::cout << "Press Enter to exit..."; std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-    std::cin.get();
+    if (!opt.pgn.empty()) {
+        std::vector<Game::Move> played;
+        std::string startFen = gameRecord(g, played);
+        bool vsComputer = autoPlayBlack;
+        if (appendPgn(opt.pgn, {{"Event", "Console game"}, {"Site", "?"}, {"Date", "????.??.??"}, {"Round", "-"},
+                                {"White", "Human"}, {"Black", vsComputer ? "Computer" : "Human"}, {"Result", result}},
+                      startFen, played, result))
+            std::cout << "Game saved to " << opt.pgn << "\n";
+    }
+
+    std::cout << "Type 'analyze' to review the game, or press Enter to exit: ";
+    std::string line;
+    if (std::getline(std::cin, line) && line == "analyze") {
+        reviewGame();
+        std::cout << "Press Enter to exit..."; std::getline(std::cin, line);
+    }
     return 0;
 }
\ No newline at end of file
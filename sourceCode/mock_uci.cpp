@@ -0,0 +1,68 @@
+// Scripted UCI engine for exercising uci_chess without Stockfish
+// Compile: g++ -std=c++17 -O2 -o mock_uci mock_uci.cpp
+// Run:     mock_uci [--delay MS] [--info N] [--loop] [move ...]
+// Answers "uci" and "isready" at once. Each "go" gets N info lines
+// (default 1, spread over the MultiPV setting) and the next scripted
+// move after --delay milliseconds (default 0), then
+// "bestmove (none)" once the script runs out, or the script again with
+// --loop. With no moves given it plays a short line for Black against 1. e4.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+int main(int argc, char **argv) {
+    int delayMs = 0;
+    bool loop = false;
+    int infoLines = 1, multiPv = 1;
+    std::vector<std::string> script;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "--delay" && i + 1 < argc) delayMs = std::atoi(argv[++i]);
+        else if (a == "--loop") loop = true;
+        else if (a == "--info" && i + 1 < argc) infoLines = std::atoi(argv[++i]);
+        else script.push_back(a);
+    }
+    if (script.empty()) script = {"e7e5", "b8c6", "g8f6", "f8c5", "d7d6", "e8g8"};
+
+    size_t next = 0;
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream in(line);
+        std::string cmd;
+        in >> cmd;
+        if (cmd == "uci") {
+            std::cout << "id name Mock UCI\nid author ASYS\nuciok" << std::endl;
+        } else if (cmd == "isready") {
+            std::cout << "readyok" << std::endl;
+        } else if (cmd == "setoption") {
+            std::string word, name, value;
+            while (in >> word) {
+                if (word == "name") in >> name;
+                else if (word == "value") in >> value;
+            }
+            if (name == "MultiPV") multiPv = std::max(1, std::atoi(value.c_str()));
+        } else if (cmd == "go") {
+            if (loop && next == script.size()) next = 0;
+            std::string move = next < script.size() ? script[next++] : "(none)";
+            if (delayMs > 0) std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+            std::ostringstream out;
+            for (int i = 0; i < infoLines && move != "(none)"; i++) {
+                int depth = 1 + i / multiPv, pv = 1 + i % multiPv;
+                out << "info depth " << depth << " seldepth " << depth + 3 << " multipv " << pv << " score cp "
+                    << 20 - 15 * (pv - 1) << " nodes " << 1000 * (i + 1) << " nps 1000000 time " << delayMs
+                    << " pv " << (pv == 1 ? move : "a7a6") << " g1f3 b8c6\n";
+            }
+            out << "bestmove " << move << "\n";
+            std::cout << out.str() << std::flush;
+        } else if (cmd == "quit") {
+            break;
+        }
+    }
+    return 0;
+}
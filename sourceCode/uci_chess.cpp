@@ -1,25 +1,476 @@
-// Windows-native console chess vs Stockfish with ASCII board
-// Compile (MSVC):   cl /EHsc win_chess.cpp
-// Compile (MinGW): g++ -std=c++17 -O2 -o win_chess win_chess.cpp
-// Run:             win_chess.exe
+// Console chess vs a UCI engine (Stockfish by default) with ASCII board
+// Compile (MSVC):   cl /EHsc uci_chess.cpp
+// Compile (MinGW): g++ -std=c++17 -O2 -o uci_chess uci_chess.cpp
+// Compile (Linux): g++ -std=c++17 -O2 -pthread -o uci_chess uci_chess.cpp
+// Run:             uci_chess.exe [engine [engine args...]] [--bench N]
+// Batch:           uci_chess.exe [engine] --batch FILE [--engines N] [--hash MB]
+//                      [--threads N] [--go "depth 12"] [--out FILE]
+// Cache:           --cache FILE [--cache-mb N] reuses earlier engine answers
+// Analysis:        --multipv N shows the engine's N best lines while it thinks
+// Time control:    --tc BASE+INC in seconds (default 300+3), or --movetime MS
+// mock_uci.cpp is a scripted stand-in engine for trying this without
+// Stockfish, e.g. "uci_chess ./mock_uci --bench 1000" measures I/O latency.
 
+#if defined(_WIN32)
 #include <windows.h>
+#else
+#include <csignal>
+#include <cerrno>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char **environ;
+#endif
 #include <iostream>
 #include <string>
 #include <vector>
 #include <sstream>
 #include <cctype>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <string_view>
+#include <algorithm>
+#include <cstdio>
+#include <atomic>
+#include <fstream>
+#include <memory>
+
+// ------------------------------------------------------
+// Info lines
+// ------------------------------------------------------
+// "info" lines are tokenized in place: views point into the reader's
+// buffer, numbers are converted without copies, and only the PV of a
+// scored line is copied into its MultiPV slot, whose string keeps its
+// capacity from search to search. This keeps up with engines printing
+// thousands of lines per second.
+struct InfoLine {
+    int depth = -1, seldepth = -1, multipv = 1;
+    bool hasScore = false, mate = false;
+    int score = 0;
+    const char *bound = "";       // "", "lowerbound" or "upperbound"
+    std::uint64_t nodes = 0, nps = 0;
+    int time = -1;                // ms the engine has searched
+    std::string_view pv;
+};
+
+static bool next_token(std::string_view &rest, std::string_view &token) {
+    const char *p = rest.data(), *end = p + rest.size();
+    while (p < end && *p == ' ') ++p;
+    if (p == end) return false;
+    const char *start = p;
+    p = (const char *)std::memchr(p, ' ', end - p);
+    if (!p) p = end;
+    token = std::string_view(start, p - start);
+    rest = std::string_view(p, end - p);
+    return true;
+}
+
+static std::int64_t to_int(std::string_view t) {
+    bool negative = !t.empty() && t[0] == '-';
+    std::int64_t v = 0;
+    for (size_t i = negative ? 1 : 0; i < t.size() && t[i] >= '0' && t[i] <= '9'; i++) v = v * 10 + (t[i] - '0');
+    return negative ? -v : v;
+}
+
+// False unless the line is an "info" line; "info string" text is skipped.
+bool parse_info(std::string_view line, InfoLine &info) {
+    std::string_view rest = line, token, value;
+    if (!next_token(rest, token) || token != "info") return false;
+    info = InfoLine();
+    // Keys are told apart by their first letter before any full compare;
+    // unknown keys ("time", "hashfull", "currmove", ...) skip their value.
+    while (next_token(rest, token)) {
+        char c = token[0];
+        if (c == 'p' && token == "pv") {
+            const char *p = rest.data(), *end = p + rest.size();
+            while (p < end && *p == ' ') ++p;
+            info.pv = std::string_view(p, end - p);
+            break;
+        }
+        if (c == 's' && token == "string") break;
+        if ((c == 'l' && token == "lowerbound") || (c == 'u' && token == "upperbound")) {
+            info.bound = c == 'l' ? "lowerbound" : "upperbound";
+            continue;
+        }
+        if (c == 's' && token == "score") {
+            if (!next_token(rest, token) || !next_token(rest, value)) break;
+            info.hasScore = true;
+            info.mate = token[0] == 'm';
+            info.score = (int)to_int(value);
+            continue;
+        }
+        if (!next_token(rest, value)) break;
+        switch (c) {
+        case 'd': if (token == "depth") info.depth = (int)to_int(value); break;
+        case 's': if (token == "seldepth") info.seldepth = (int)to_int(value); break;
+        case 'm': if (token == "multipv") info.multipv = (int)to_int(value); break;
+        case 't': if (token == "time") info.time = (int)to_int(value); break;
+        case 'n':
+            if (token == "nodes") info.nodes = (std::uint64_t)to_int(value);
+            else if (token == "nps") info.nps = (std::uint64_t)to_int(value);
+            break;
+        }
+    }
+    return true;
+}
+
+// The latest search state, one line per MultiPV index.
+struct PvLine {
+    int depth = 0, seldepth = 0;
+    bool mate = false;
+    int score = 0;
+    const char *bound = "";
+    std::string pv;
+};
+
+struct Analysis {
+    static constexpr int MAX_LINES = 64;
+    int depth = 0, seldepth = 0;
+    std::uint64_t nodes = 0, nps = 0;
+    int timeMs = 0;
+    std::uint64_t updates = 0;    // info lines folded in
+    std::vector<PvLine> lines;    // only the first `count` are in use
+    int count = 0;
+
+    // Keeps the PvLines, and so their PV strings' capacity, for reuse.
+    void clear() {
+        depth = seldepth = timeMs = 0;
+        nodes = nps = 0;
+        count = 0;
+    }
+
+    void add(const InfoLine &info) {
+        ++updates;
+        if (info.depth >= 0) depth = info.depth;
+        if (info.seldepth >= 0) seldepth = info.seldepth;
+        if (info.nodes) nodes = info.nodes;
+        if (info.nps) nps = info.nps;
+        if (info.time >= 0) timeMs = info.time;
+        if (!info.hasScore || info.multipv < 1 || info.multipv > MAX_LINES) return;
+        if ((int)lines.size() < info.multipv) lines.resize(info.multipv);
+        for (; count < info.multipv; count++) {
+            PvLine &unused = lines[count];
+            unused.depth = unused.seldepth = unused.score = 0;
+            unused.mate = false;
+            unused.bound = "";
+            unused.pv.clear();
+        }
+        PvLine &l = lines[info.multipv - 1];
+        l.depth = depth;
+        l.seldepth = seldepth;
+        l.mate = info.mate;
+        l.score = info.score;
+        l.bound = info.bound;
+        l.pv.assign(info.pv.data(), info.pv.size());
+    }
+};
 
 struct Engine {
+#if defined(_WIN32)
     HANDLE hChildStdinWr = nullptr;
     HANDLE hChildStdoutRd = nullptr;
     PROCESS_INFORMATION piProc = {};
+#else
+    pid_t pid = -1;
+    int stdinWr = -1;
+    int stdoutRd = -1;
+#endif
+    // The reader thread splits engine output into lines. Info lines are
+    // folded into `analysis`; the rest are queued and wake waiters.
+    std::thread reader;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::string> lines;
+    Analysis analysis;
+    std::atomic<bool> eof{false};   // set under `lock`; read without it to check for a dead engine
+};
+
+// ------------------------------------------------------
+// Result cache
+// ------------------------------------------------------
+// --cache FILE keeps engine answers in a memory-mapped open-addressing
+// table keyed by a hash of the position's FEN and the go arguments, so a
+// position analyzed before is answered without asking the engine (games
+// under a clock skip it: their go arguments carry the time left). A
+// writer claims a slot by swapping its even sequence number for a larger
+// odd one that also records when (in seconds), fills the slot and makes
+// the number even again; other writers leave an odd slot alone unless the
+// claim is older than STALE_SECONDS, i.e. its writer died. Readers copy
+// the slot and keep it only if the sequence did not move and the checksum
+// matches, so a crashed writer, or one that stalled past the stale limit
+// and races its successor, costs an entry, never a wrong answer. Any
+// number of processes may share it.
+struct EngineReply {
+    std::string bestmove;
+    std::string score;            // "cp N" / "mate N"
+    std::string pv;
+    int depth = 0;
+    int engineMs = 0;             // search time the engine reported; not cached
+};
+
+struct CacheSlot {
+    std::atomic<std::uint64_t> seq;
+    std::uint64_t key;
+    std::uint64_t check;
+    std::int32_t depth;
+    char bestmove[8];
+    char score[12];
+    char pv[80];
+};
+static_assert(sizeof(CacheSlot) == 128, "cache slots are 128 bytes");
+
+static std::uint64_t hash_bytes(const void *data, size_t len, std::uint64_t h = 1469598103934665603ull) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 1099511628211ull;
+    return h ^ (h >> 29);
+}
+
+// The part of a FEN that decides the engine's answer, written one way:
+// placement, side, castling, and the en passant square only when a pawn
+// can actually take there. The game and --batch key the cache on this, so
+// a position analyzed in one is found by the other.
+std::string cache_fen(const std::string &fen) {
+    std::istringstream in(fen);
+    std::string placement, side, castling, ep;
+    in >> placement >> side >> castling >> ep;
+    if (ep.size() == 2 && ep[0] >= 'a' && ep[0] <= 'h' && (ep[1] == '3' || ep[1] == '6')) {
+        char board[8][8] = {};
+        int r = 0, c = 0;
+        for (char ch : placement) {
+            if (ch == '/') { ++r; c = 0; }
+            else if (std::isdigit((unsigned char)ch)) c += ch - '0';
+            else if (r < 8 && c < 8) board[r][c++] = ch;
+        }
+        // the capturing pawns stand beside the square, on the pushed pawn's rank
+        bool white = side == "w";
+        int row = white ? 3 : 4, col = ep[0] - 'a';
+        char pawn = white ? 'P' : 'p';
+        bool capture = (col > 0 && board[row][col - 1] == pawn) || (col < 7 && board[row][col + 1] == pawn);
+        if (!capture) ep = "-";
+    } else {
+        ep = "-";
+    }
+    return placement + " " + side + " " + (castling.empty() ? "-" : castling) + " " + ep;
+}
+
+struct ResultCache {
+    static constexpr char MAGIC[8] = {'A', 'S', 'Y', 'S', 'U', 'C', '0', '1'};
+    static constexpr size_t HEADER = 128;
+    static constexpr int WINDOW = 8;  // slots probed per key
+    static constexpr std::uint64_t STALE_SECONDS = 10;  // an older claim is taken over
+    unsigned char *base = nullptr;
+    size_t size = 0;
+    CacheSlot *slots = nullptr;
+    std::uint64_t count = 0;
+    std::atomic<std::uint64_t> hits{0};
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = nullptr;
+#endif
+
+    ResultCache() = default;
+    ResultCache(const ResultCache &) = delete;
+    ResultCache &operator=(const ResultCache &) = delete;
+    ~ResultCache() { close(); }
+
+    // Opens or creates the cache; a new file gets sizeMb of slots.
+    bool open(const std::string &path, int sizeMb) {
+        std::uint64_t wanted = HEADER + (std::uint64_t)sizeMb * (1 << 20) / sizeof(CacheSlot) * sizeof(CacheSlot);
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                           OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER existing;
+        if (!GetFileSizeEx(file, &existing)) { close(); return false; }
+        size = existing.QuadPart >= (LONGLONG)HEADER ? (size_t)existing.QuadPart : (size_t)wanted;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)((std::uint64_t)size >> 32), (DWORD)size, nullptr);
+        if (!mapping) { close(); return false; }
+        base = (unsigned char *)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+        if (!base) { close(); return false; }
+#else
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (st.st_size < (off_t)HEADER && ftruncate(fd, (off_t)wanted) != 0)) {
+            ::close(fd);
+            return false;
+        }
+        size = st.st_size >= (off_t)HEADER ? (size_t)st.st_size : (size_t)wanted;
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        base = (unsigned char *)p;
+#endif
+        // A fresh file is all zeros, which is an empty table; every process
+        // that creates it writes the same header.
+        std::uint64_t fileSlots = (size - HEADER) / sizeof(CacheSlot);
+        if (std::memcmp(base, MAGIC, 8) != 0) {
+            std::uint64_t stored;
+            std::memcpy(&stored, base + 8, 8);
+            if (stored != 0) { close(); return false; }  // not a cache file
+            std::memcpy(base + 8, &fileSlots, 8);
+            std::memcpy(base, MAGIC, 8);
+        }
+        std::memcpy(&count, base + 8, 8);
+        if (count == 0 || count > fileSlots) { close(); return false; }
+        slots = (CacheSlot *)(base + HEADER);
+        return true;
+    }
+
+    void close() {
+#if defined(_WIN32)
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (base) munmap(base, size);
+#endif
+        base = nullptr;
+        slots = nullptr;
+    }
+
+    // Keyed on the normalized FEN (see cache_fen) and the go arguments.
+    static std::uint64_t key_of(const std::string &fen, const std::string &go) {
+        std::string position = cache_fen(fen);
+        std::uint64_t h = hash_bytes(position.data(), position.size());
+        h = hash_bytes(go.data(), go.size(), h * 31 + 7);
+        return h ? h : 1;  // 0 marks an empty slot
+    }
+
+    // Covers everything after the checksum, seeded with the key.
+    static std::uint64_t checksum(const CacheSlot &s) {
+        return hash_bytes(&s.depth, sizeof(CacheSlot) - offsetof(CacheSlot, depth), s.key);
+    }
+
+    // Copies slot i if it holds a complete entry.
+    bool read_slot(std::uint64_t i, CacheSlot &copy) const {
+        std::uint64_t before = slots[i].seq.load(std::memory_order_acquire);
+        if (before & 1) return false;
+        std::memcpy((char *)&copy + sizeof(copy.seq), (const char *)&slots[i] + sizeof(copy.seq),
+                    sizeof(CacheSlot) - sizeof(copy.seq));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slots[i].seq.load(std::memory_order_relaxed) == before && copy.key != 0 && copy.check == checksum(copy);
+    }
+
+    bool probe(std::uint64_t key, EngineReply &reply) {
+        if (!slots) return false;
+        CacheSlot copy;
+        for (int w = 0; w < WINDOW; w++) {
+            if (!read_slot((key + w) % count, copy) || copy.key != key) continue;
+            reply.bestmove.assign(copy.bestmove, strnlen(copy.bestmove, sizeof(copy.bestmove)));
+            reply.score.assign(copy.score, strnlen(copy.score, sizeof(copy.score)));
+            reply.pv.assign(copy.pv, strnlen(copy.pv, sizeof(copy.pv)));
+            reply.depth = copy.depth;
+            hits++;
+            return true;
+        }
+        return false;
+    }
+
+    // Stores over the same key, an empty or damaged slot, or the shallowest
+    // entry in the probe window. Best effort: a slot being written by
+    // someone else is skipped, unless that claim has gone stale.
+    void store(std::uint64_t key, const EngineReply &reply) {
+        if (!slots || reply.bestmove.size() >= sizeof(CacheSlot::bestmove)) return;
+        std::uint64_t target = key % count;
+        int targetDepth = 1 << 30;
+        CacheSlot copy;
+        for (int w = 0; w < WINDOW; w++) {
+            std::uint64_t i = (key + w) % count;
+            if (!read_slot(i, copy) || copy.key == key) { target = i; break; }
+            if (copy.depth < targetDepth) { target = i; targetDepth = copy.depth; }
+        }
+        CacheSlot fill;
+        std::memset((char *)&fill, 0, sizeof(fill));
+        fill.key = key;
+        fill.depth = reply.depth;
+        std::memcpy(fill.bestmove, reply.bestmove.data(), reply.bestmove.size());
+        std::memcpy(fill.score, reply.score.data(), std::min(reply.score.size(), sizeof(fill.score) - 1));
+        // Keep whole moves of the PV that fit.
+        size_t pvLen = std::min(reply.pv.size(), sizeof(fill.pv) - 1);
+        if (pvLen < reply.pv.size()) pvLen = reply.pv.rfind(' ', pvLen) == std::string::npos ? 0 : reply.pv.rfind(' ', pvLen);
+        std::memcpy(fill.pv, reply.pv.data(), pvLen);
+        fill.check = checksum(fill);
+
+        CacheSlot &slot = slots[target];
+        std::uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+        std::uint64_t now = (std::uint64_t)std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        if ((seq & 1) && (seq >> 1) + STALE_SECONDS > now) return;
+        // Odd, past every earlier value, and at least the current time.
+        std::uint64_t claim = std::max(seq + 1 + (seq & 1), (now << 1) | 1);
+        if (!slot.seq.compare_exchange_strong(seq, claim, std::memory_order_acquire)) return;
+        std::memcpy((char *)&slot + sizeof(slot.seq), (const char *)&fill + sizeof(fill.seq), sizeof(CacheSlot) - sizeof(slot.seq));
+        slot.seq.store(claim + 1, std::memory_order_release);
+    }
 };
 
 // ------------------------------------------------------
 // Engine communication
 // ------------------------------------------------------
-bool launch_engine(const std::string &path, Engine &eng) {
+// Blocking read of whatever the engine has written; <= 0 once it exits.
+static int read_chunk(Engine &eng, char *buf, int size) {
+#if defined(_WIN32)
+    DWORD read = 0;
+    if (!ReadFile(eng.hChildStdoutRd, buf, (DWORD)size, &read, nullptr)) return 0;
+    return (int)read;
+#else
+    while (true) {
+        ssize_t n = read(eng.stdoutRd, buf, size);
+        if (n >= 0 || errno != EINTR) return (int)n;
+    }
+#endif
+}
+
+// Lines are cut straight out of the read buffer; only a line split across
+// two reads is moved to the front of it.
+static void reader_loop(Engine &eng) {
+    std::vector<char> buf(1 << 16);
+    size_t filled = 0;
+    InfoLine info;
+    int n;
+    while ((n = read_chunk(eng, buf.data() + filled, (int)(buf.size() - filled))) > 0) {
+        filled += n;
+        const char *start = buf.data(), *end = buf.data() + filled, *nl;
+        bool queued = false;
+        {
+            std::lock_guard<std::mutex> guard(eng.lock);
+            while ((nl = (const char *)std::memchr(start, '\n', end - start)) != nullptr) {
+                std::string_view line(start, nl - start);
+                if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                if (parse_info(line, info)) eng.analysis.add(info);
+                else if (!line.empty()) {
+                    eng.lines.emplace_back(line);
+                    queued = true;
+                }
+                start = nl + 1;
+            }
+        }
+        if (queued) eng.wake.notify_all();
+        filled = end - start;
+        std::memmove(buf.data(), start, filled);
+        if (filled == buf.size()) buf.resize(buf.size() * 2);
+    }
+    std::lock_guard<std::mutex> guard(eng.lock);
+    eng.eof = true;
+    eng.wake.notify_all();
+}
+
+bool launch_engine(const std::vector<std::string> &args, Engine &eng) {
+#if defined(_WIN32)
     SECURITY_ATTRIBUTES sa{sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
     HANDLE hStdoutRd = nullptr, hStdoutWr = nullptr;
     HANDLE hStdinRd = nullptr, hStdinWr = nullptr;
@@ -37,10 +488,12 @@ bool launch_engine(const std::string &path, Engine &eng) {
     si.hStdInput = hStdinRd;
     si.dwFlags |= STARTF_USESTDHANDLES;
 
+    std::string cmdLine;
+    for (const auto &a : args) cmdLine += (cmdLine.empty() ? "\"" : " \"") + a + "\"";
     PROCESS_INFORMATION pi{};
     BOOL ok = CreateProcessA(
-        path.c_str(),
-        nullptr,
+        args[0].c_str(),
+        &cmdLine[0],
         nullptr, nullptr, TRUE,
         0, nullptr, nullptr,
         &si, &pi
@@ -53,33 +506,474 @@ bool launch_engine(const std::string &path, Engine &eng) {
     eng.hChildStdoutRd = hStdoutRd;
     eng.hChildStdinWr = hStdinWr;
     eng.piProc = pi;
+#else
+    int in[2], out[2];
+    if (pipe(in) != 0) return false;
+    if (pipe(out) != 0) { close(in[0]); close(in[1]); return false; }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in[0], 0);
+    posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, out[1], 2);
+    posix_spawn_file_actions_addclose(&actions, in[1]);
+    posix_spawn_file_actions_addclose(&actions, out[0]);
+    std::vector<char *> argv;
+    for (const auto &a : args) argv.push_back(const_cast<char *>(a.c_str()));
+    argv.push_back(nullptr);
+    int rc = posix_spawnp(&eng.pid, args[0].c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(in[0]);
+    close(out[1]);
+
+    if (rc != 0) { close(in[1]); close(out[0]); return false; }
+
+    signal(SIGPIPE, SIG_IGN);   // a dead engine shows up as eof, not a signal
+    eng.stdinWr = in[1];
+    eng.stdoutRd = out[0];
+#endif
+    eng.reader = std::thread(reader_loop, std::ref(eng));
     return true;
 }
 
 void send_cmd(Engine &eng, const std::string &cmd) {
     std::string s = cmd + "\n";
+#if defined(_WIN32)
     DWORD written;
     WriteFile(eng.hChildStdinWr, s.c_str(), (DWORD)s.size(), &written, nullptr);
+#else
+    for (size_t done = 0; done < s.size(); ) {
+        ssize_t n = write(eng.stdinWr, s.c_str() + done, s.size() - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+#endif
+}
+
+// Waits for a line whose first word is `token` ("uciok", "readyok",
+// "bestmove") and returns it, dropping the lines before it. Returns "" if
+// the engine exits first or after timeoutMs, which is only a safety net:
+// the reader thread wakes us as soon as the line arrives. If given,
+// onUpdate gets a copy of the analysis about ten times a second while it
+// changes.
+std::string wait_for(Engine &eng, const std::string &token, int timeoutMs,
+                     const std::function<void(const Analysis &)> &onUpdate = nullptr) {
+    using clock = std::chrono::steady_clock;
+    auto deadline = clock::now() + std::chrono::milliseconds(timeoutMs);
+    std::uint64_t shown = 0;
+    Analysis snapshot;
+    std::unique_lock<std::mutex> guard(eng.lock);
+    while (true) {
+        while (!eng.lines.empty()) {
+            std::string line = std::move(eng.lines.front());
+            eng.lines.pop_front();
+            if (line.compare(0, token.size(), token) == 0 && (line.size() == token.size() || line[token.size()] == ' '))
+                return line;
+        }
+        if (eng.eof) return "";
+        if (onUpdate && eng.analysis.updates != shown) {
+            shown = eng.analysis.updates;
+            snapshot = eng.analysis;
+            guard.unlock();
+            onUpdate(snapshot);
+            guard.lock();
+            continue;
+        }
+        auto until = onUpdate ? std::min(deadline, clock::now() + std::chrono::milliseconds(100)) : deadline;
+        if (eng.wake.wait_until(guard, until) == std::cv_status::timeout && eng.lines.empty() && clock::now() >= deadline)
+            return "";
+    }
+}
+
+void close_engine(Engine &eng) {
+    send_cmd(eng, "quit");
+#if defined(_WIN32)
+    if (WaitForSingleObject(eng.piProc.hProcess, 1000) == WAIT_TIMEOUT) TerminateProcess(eng.piProc.hProcess, 0);
+    if (eng.reader.joinable()) eng.reader.join();
+    CloseHandle(eng.piProc.hThread);
+    CloseHandle(eng.piProc.hProcess);
+    CloseHandle(eng.hChildStdinWr);
+    CloseHandle(eng.hChildStdoutRd);
+#else
+    close(eng.stdinWr);
+    int status;
+    bool exited = false;
+    for (int i = 0; i < 100 && !exited; i++) {
+        exited = waitpid(eng.pid, &status, WNOHANG) == eng.pid;
+        if (!exited) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    if (!exited) {
+        kill(eng.pid, SIGKILL);
+        waitpid(eng.pid, &status, 0);
+    }
+    if (eng.reader.joinable()) eng.reader.join();
+    close(eng.stdoutRd);
+#endif
+}
+
+// Value following `key` in an info line ("cp 31" for key "score", which
+// takes two words), or "" if absent.
+std::string info_field(const std::string &line, const std::string &key, int words) {
+    std::istringstream in(line);
+    std::string w, value;
+    while (in >> w)
+        if (w == key) {
+            for (int i = 0; i < words && in >> w; i++) value += (i ? " " : "") + w;
+            return value;
+        }
+    return "";
+}
+
+// Starts a search; the analysis is cleared first so it only shows this one.
+void start_search(Engine &eng, const std::string &position, const std::string &go) {
+    {
+        std::lock_guard<std::mutex> guard(eng.lock);
+        eng.analysis.clear();
+    }
+    send_cmd(eng, position);
+    send_cmd(eng, "go " + go);
+}
+
+// Fills `reply` from the bestmove line and the main line of the analysis.
+void parse_reply(Engine &eng, const std::string &bestmoveLine, EngineReply &reply) {
+    reply.bestmove = info_field(bestmoveLine, "bestmove", 1);
+    std::lock_guard<std::mutex> guard(eng.lock);
+    if (eng.analysis.count == 0) return;
+    const PvLine &main = eng.analysis.lines[0];
+    reply.score = (main.mate ? "mate " : "cp ") + std::to_string(main.score);
+    reply.depth = main.depth;
+    reply.pv = main.pv;
+    reply.engineMs = eng.analysis.timeMs;
+}
+
+// Draws the MultiPV panel in place: each call moves back over the lines
+// the previous one printed. Without a terminal it only prints the final
+// state, from finish().
+struct AnalysisPanel {
+    bool live = false;
+    int printed = 0;
+    Analysis last;
+
+    static std::string format_score(const PvLine &l) {
+        char buf[32];
+        if (l.mate) std::snprintf(buf, sizeof buf, "#%d", l.score);
+        else std::snprintf(buf, sizeof buf, "%+.2f", l.score / 100.0);
+        return std::string(buf) + (l.bound[0] ? (l.bound[0] == 'l' ? "+" : "-") : "");
+    }
+
+    void draw(const Analysis &a) {
+        std::ostringstream out;
+        for (int i = 0; i < printed; i++) out << "\x1b[1F\x1b[2K";
+        out << "depth " << a.depth;
+        if (a.seldepth) out << "/" << a.seldepth;
+        out << "  nodes " << a.nodes << "  nps " << a.nps << "\n";
+        for (int i = 0; i < a.count; i++) {
+            std::string pv = a.lines[i].pv.substr(0, 60);
+            out << " " << i + 1 << ". " << format_score(a.lines[i]) << "  " << pv << "\n";
+        }
+        printed = 1 + a.count;
+        std::cout << out.str() << std::flush;
+    }
+
+    void update(const Analysis &a) {
+        last = a;
+        if (live) draw(a);
+    }
+
+    void finish() {
+        if (!live && last.count) draw(last);
+        printed = 0;
+        last.clear();
+    }
+};
+
+// Longest a search with these go arguments may take before we give up on
+// the engine.
+int go_timeout_ms(const std::string &go) {
+    std::string movetime = info_field("go " + go, "movetime", 1);
+    if (!movetime.empty()) return std::atoi(movetime.c_str()) + 10000;
+    int wtime = std::atoi(info_field("go " + go, "wtime", 1).c_str());
+    int btime = std::atoi(info_field("go " + go, "btime", 1).c_str());
+    return wtime || btime ? std::max(wtime, btime) + 10000 : 3600000;
+}
+
+// After a bestmove wait timed out: tells the engine to stop and drops its
+// output up to the late bestmove, so that line is not taken as the answer
+// to the next search. Returns false if the engine does not stop either.
+bool abandon_search(Engine &eng) {
+    send_cmd(eng, "stop");
+    return !wait_for(eng, "bestmove", 5000).empty();
+}
+
+// Sends `position` and "go <go>" and returns the engine's move ("" if it
+// gave none), with the time from "go" to "bestmove" in replyMs and the
+// engine's own account of it in engineMs (0 if it did not say). The cache,
+// if given, is keyed on `fen` (the position itself, so move orders that
+// transpose share an entry) and the go arguments.
+std::string engine_move(Engine &eng, const std::string &position, const std::string &fen, const std::string &go,
+                        double &replyMs, int &engineMs, ResultCache *cache, bool &cached,
+                        AnalysisPanel *panel = nullptr) {
+    std::uint64_t key = ResultCache::key_of(fen, go);
+    EngineReply reply;
+    auto start = std::chrono::steady_clock::now();
+    cached = cache && cache->probe(key, reply);
+    if (!cached) {
+        start_search(eng, position, go);
+        int timeoutMs = go_timeout_ms(go);
+        std::string line = panel ? wait_for(eng, "bestmove", timeoutMs,
+                                            [panel](const Analysis &a) { panel->update(a); })
+                                 : wait_for(eng, "bestmove", timeoutMs);
+        if (line.empty()) abandon_search(eng);
+        if (panel) {
+            Analysis final;
+            {
+                std::lock_guard<std::mutex> guard(eng.lock);
+                final = eng.analysis;
+            }
+            panel->update(final);
+            panel->finish();
+        }
+        if (!line.empty()) {
+            parse_reply(eng, line, reply);
+            if (cache) cache->store(key, reply);
+        }
+    }
+    replyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    engineMs = reply.engineMs;
+    return reply.bestmove;
+}
+
+// uci/uciok, the given setoption commands, then isready/readyok.
+bool uci_handshake(Engine &eng, const std::vector<std::string> &options) {
+    send_cmd(eng, "uci");
+    if (wait_for(eng, "uciok", 5000).empty()) return false;
+    for (const auto &o : options) send_cmd(eng, o);
+    send_cmd(eng, "isready");
+    return !wait_for(eng, "readyok", 30000).empty();
 }
 
-std::string read_output(Engine &eng, int timeoutMs = 500) {
-    std::string result;
-    char buf[4096];
-    DWORD avail = 0;
-    DWORD start = GetTickCount();
-    while (GetTickCount() - start < (DWORD)timeoutMs) {
-        if (!PeekNamedPipe(eng.hChildStdoutRd, nullptr, 0, nullptr, &avail, nullptr)) break;
-        if (avail == 0) {
-            Sleep(50);
+// Round trips through the engine: isready/readyok, then "go depth 1"/bestmove.
+void run_bench(Engine &eng, int rounds) {
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    for (int i = 0; i < rounds; i++) {
+        send_cmd(eng, "isready");
+        wait_for(eng, "readyok", 10000);
+    }
+    double readyUs = std::chrono::duration<double, std::micro>(clock::now() - start).count() / rounds;
+    start = clock::now();
+    for (int i = 0; i < rounds; i++) {
+        send_cmd(eng, "position startpos");
+        send_cmd(eng, "go depth 1");
+        wait_for(eng, "bestmove", 10000);
+    }
+    double goSecs = std::chrono::duration<double>(clock::now() - start).count();
+    std::uint64_t infoLines;
+    {
+        std::lock_guard<std::mutex> guard(eng.lock);
+        infoLines = eng.analysis.updates;
+    }
+    std::cout << rounds << " rounds: isready -> readyok " << readyUs << " us, go depth 1 -> bestmove "
+              << goSecs * 1e6 / rounds << " us, " << infoLines << " info lines (" << infoLines / goSecs << "/s)\n";
+
+    // The tokenizer on its own, over a typical MultiPV line.
+    const std::string sample = "info depth 24 seldepth 33 multipv 2 score cp -17 upperbound nodes 18253311 "
+                               "nps 2104566 hashfull 412 tbhits 0 time 8673 pv e7e5 g1f3 b8c6 f1b5 a7a6 b5a4 g8f6 e1g1";
+    Analysis a;
+    InfoLine info;
+    const int parses = 1000000;
+    start = clock::now();
+    for (int i = 0; i < parses; i++)
+        if (parse_info(sample, info)) a.add(info);
+    double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / parses;
+    std::cout << "info line parse: " << ns << " ns (" << a.count << " lines, depth " << a.depth << ")\n";
+}
+
+// ------------------------------------------------------
+// Batch analysis
+// ------------------------------------------------------
+// --batch FILE runs every position of FILE through a pool of long-lived
+// engine processes. Each line is a FEN, optionally followed by "; <go
+// arguments>" to override --go for that position. Every engine gets its
+// own Hash/Threads settings and is reset with ucinewgame + isready before
+// each job, so results do not depend on which engine took the position.
+struct BatchOptions {
+    int engines = 1;
+    int hashMb = 16;              // per engine
+    int threads = 1;              // per engine
+    std::string go = "movetime 1000";
+    std::string out;              // results file; stdout if empty
+    ResultCache *cache = nullptr;
+};
+
+struct BatchJob {
+    std::string fen, go;
+    EngineReply reply;
+    bool done = false;
+    bool cached = false;
+};
+
+static void run_job(Engine &eng, BatchJob &job, ResultCache *cache) {
+    std::string position = "position fen " + job.fen;
+    std::uint64_t key = ResultCache::key_of(job.fen, job.go);
+    if (cache && cache->probe(key, job.reply)) {
+        job.done = job.cached = true;
+        return;
+    }
+    send_cmd(eng, "ucinewgame");
+    send_cmd(eng, "isready");
+    if (wait_for(eng, "readyok", 30000).empty()) return;
+    start_search(eng, position, job.go);
+    std::string line = wait_for(eng, "bestmove", go_timeout_ms(job.go));
+    if (line.empty()) {
+        abandon_search(eng);
+        return;
+    }
+    parse_reply(eng, line, job.reply);
+    if (cache) cache->store(key, job.reply);
+    job.done = true;
+}
+
+int run_batch(const std::vector<std::string> &engineArgs, const std::string &path, const BatchOptions &opt) {
+    std::ifstream file(path);
+    if (!file) { std::cerr << "Could not open " << path << "\n"; return 1; }
+    std::vector<BatchJob> jobs;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        BatchJob job;
+        size_t semi = line.find(';');
+        job.fen = line.substr(0, semi);
+        job.go = semi == std::string::npos ? opt.go : line.substr(semi + 1);
+        while (!job.fen.empty() && job.fen.back() == ' ') job.fen.pop_back();
+        while (!job.go.empty() && job.go[0] == ' ') job.go.erase(0, 1);
+        jobs.push_back(job);
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto start = clock::now();
+    std::vector<std::unique_ptr<Engine>> pool;
+    std::vector<std::string> options{"setoption name Hash value " + std::to_string(opt.hashMb),
+                                     "setoption name Threads value " + std::to_string(opt.threads)};
+    for (int i = 0; i < opt.engines; i++) {
+        auto eng = std::make_unique<Engine>();
+        if (!launch_engine(engineArgs, *eng)) {
+            std::cerr << "Failed to start engine at: " << engineArgs[0] << "\n";
+            break;
+        }
+        if (!uci_handshake(*eng, options)) {
+            std::cerr << engineArgs[0] << " did not answer uci/isready\n";
+            close_engine(*eng);
             continue;
         }
-        DWORD read = 0;
-        if (ReadFile(eng.hChildStdoutRd, buf, sizeof(buf)-1, &read, nullptr) && read > 0) {
-            buf[read] = 0;
-            result += buf;
+        pool.push_back(std::move(eng));
+    }
+    if (pool.empty()) return 1;
+    double startupMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+    start = clock::now();
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    for (auto &eng : pool)
+        workers.emplace_back([&jobs, &next, &eng, &opt]() {
+            for (size_t i; (i = next++) < jobs.size(); ) {
+                run_job(*eng, jobs[i], opt.cache);
+                if (!jobs[i].done && eng->eof) break;   // engine died; the others carry on
+            }
+        });
+    for (auto &w : workers) w.join();
+    double secs = std::chrono::duration<double>(clock::now() - start).count();
+    for (auto &eng : pool) close_engine(*eng);
+
+    std::ofstream outFile;
+    if (!opt.out.empty()) outFile.open(opt.out);
+    std::ostream &out = opt.out.empty() ? std::cout : outFile;
+    int failed = 0, cached = 0;
+    for (const auto &job : jobs) {
+        failed += !job.done;
+        cached += job.cached;
+        out << job.fen << " ; bestmove " << (job.done ? job.reply.bestmove : "?");
+        if (!job.reply.score.empty()) out << " score " << job.reply.score << " depth " << job.reply.depth;
+        if (!job.reply.pv.empty()) out << " pv " << job.reply.pv;
+        out << "\n";
+    }
+    std::cout << jobs.size() << " positions in " << secs << " s on " << pool.size() << " engines ("
+              << jobs.size() / std::max(secs, 1e-9) << " positions/s, " << cached << " from cache, " << failed
+              << " failed, startup " << startupMs << " ms)\n";
+    return failed ? 1 : 0;
+}
+
+// ------------------------------------------------------
+// Clocks
+// ------------------------------------------------------
+// Base + increment for both sides, charged with the wall time measured
+// here. The engine is told its own time minus twice the overhead of the
+// pipe and process: the gap between our stopwatch and the search time the
+// engine reports, smoothed over moves and never below the isready round
+// trip, so it does not flag on time it never saw.
+struct GameClock {
+    double remainingMs[2] = {300000, 300000};  // White, Black
+    double incMs = 3000;
+    double pingMs = 0;
+    double overheadMs = 0;
+
+    // "base+inc" in seconds, e.g. "300+3" or "60".
+    bool parse(const std::string &tc) {
+        double base = 0, inc = 0;
+        char plus = 0;
+        std::istringstream in(tc);
+        if (!(in >> base) || base <= 0) return false;
+        if (in >> plus && (plus != '+' || !(in >> inc) || inc < 0)) return false;
+        remainingMs[0] = remainingMs[1] = base * 1000;
+        incMs = inc * 1000;
+        return true;
+    }
+
+    std::string go_args(int engineSide) const {
+        long long t[2] = {(long long)remainingMs[0], (long long)remainingMs[1]};
+        t[engineSide] = std::max(1LL, (long long)(remainingMs[engineSide] - 2 * overheadMs));
+        long long inc = (long long)incMs;
+        return "wtime " + std::to_string(t[0]) + " btime " + std::to_string(t[1]) + " winc " + std::to_string(inc) +
+               " binc " + std::to_string(inc);
+    }
+
+    // Charges a move to `side`; false if its flag fell.
+    bool charge(int side, double ms) {
+        remainingMs[side] -= ms;
+        if (remainingMs[side] <= 0) {
+            remainingMs[side] = 0;
+            return false;
         }
+        remainingMs[side] += incMs;
+        return true;
+    }
+
+    void note_overhead(double wallMs, int engineMs) {
+        double sample = std::max(pingMs, wallMs - engineMs);
+        overheadMs = overheadMs <= pingMs ? sample : 0.7 * overheadMs + 0.3 * sample;
     }
-    return result;
+
+    static std::string format(double ms) {
+        long long tenths = (long long)(ms / 100);
+        char buf[32];
+        std::snprintf(buf, sizeof buf, "%lld:%02lld.%lld", tenths / 600, tenths / 10 % 60, tenths % 10);
+        return buf;
+    }
+};
+
+// Median isready/readyok round trip in milliseconds.
+double ping_ms(Engine &eng, int rounds) {
+    std::vector<double> times;
+    for (int i = 0; i < rounds; i++) {
+        auto start = std::chrono::steady_clock::now();
+        send_cmd(eng, "isready");
+        wait_for(eng, "readyok", 5000);
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
 }
 
 // ------------------------------------------------------
@@ -108,6 +1002,11 @@ void print_board() {
     std::cout << "  abcdefgh\n\n";
 }
 
+// Castling rights still held ("KQkq" minus lost ones) and the en passant
+// target ("-" or e.g. "e3"), kept so the board can be written as a FEN.
+std::string castling = "KQkq";
+std::string epSquare = "-";
+
 // apply UCI move (like "e2e4" or "e7e8q")
 void apply_move(const std::string &mv) {
     if (mv.size() < 4) return;
@@ -119,6 +1018,27 @@ void apply_move(const std::string &mv) {
     char piece = board[fromRow][fromCol];
     board[fromRow][fromCol] = '.';
 
+    // castling moves the rook too; en passant removes the pawn passed by
+    if (tolower(piece) == 'k' && std::abs(toCol - fromCol) == 2) {
+        int rookFrom = toCol > fromCol ? 7 : 0, rookTo = toCol > fromCol ? 5 : 3;
+        board[toRow][rookTo] = board[toRow][rookFrom];
+        board[toRow][rookFrom] = '.';
+    }
+    if (tolower(piece) == 'p' && fromCol != toCol && board[toRow][toCol] == '.') board[fromRow][toCol] = '.';
+    epSquare = tolower(piece) == 'p' && std::abs(toRow - fromRow) == 2
+                   ? std::string(1, mv[0]) + char('0' + 8 - (fromRow + toRow) / 2) : "-";
+    // a king or rook leaving its square, or a rook captured on it, loses the right
+    auto lose = [](int row, int col) {
+        if (row != 0 && row != 7) return;
+        std::string lost = col == 4 ? "KQ" : col == 0 ? "Q" : col == 7 ? "K" : "";
+        for (char c : lost) {
+            if (row == 0) c = (char)tolower(c);
+            castling.erase(std::remove(castling.begin(), castling.end(), c), castling.end());
+        }
+    };
+    lose(fromRow, fromCol);
+    lose(toRow, toCol);
+
     // promotion
     if (mv.size() == 5) {
         char promo = mv[4];
@@ -130,22 +1050,108 @@ void apply_move(const std::string &mv) {
     }
 }
 
+// The board as a FEN without the move counters.
+std::string board_fen(bool whiteToMove) {
+    std::string fen;
+    for (int r = 0; r < 8; r++) {
+        int empty = 0;
+        for (int c = 0; c < 8; c++) {
+            if (board[r][c] == '.') { ++empty; continue; }
+            if (empty) fen += char('0' + empty);
+            empty = 0;
+            fen += board[r][c];
+        }
+        if (empty) fen += char('0' + empty);
+        if (r < 7) fen += '/';
+    }
+    fen += whiteToMove ? " w " : " b ";
+    fen += castling.empty() ? "-" : castling;
+    return fen + " " + epSquare;
+}
+
 // ------------------------------------------------------
 // Main game loop
 // ------------------------------------------------------
-int main() {
-    std::string enginePath = "stockfish\\stockfish-windows-x86-64-avx2.exe";
+int main(int argc, char **argv) {
+#if defined(_WIN32)
+    std::vector<std::string> engineArgs{"stockfish\\stockfish-windows-x86-64-avx2.exe"};
+#else
+    std::vector<std::string> engineArgs{"stockfish"};
+#endif
+    int benchRounds = 0;
+    std::string batchPath, cachePath;
+    int cacheMb = 64;
+    int multiPv = 1;
+    std::string tc = "300+3";
+    int movetimeMs = 0;           // fixed time per engine move instead of clocks
+    BatchOptions batch;
+    std::vector<std::string> given;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--bench" && hasValue) benchRounds = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--batch" && hasValue) batchPath = argv[++i];
+        else if (a == "--engines" && hasValue) batch.engines = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--hash" && hasValue) batch.hashMb = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--threads" && hasValue) batch.threads = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--go" && hasValue) batch.go = argv[++i];
+        else if (a == "--out" && hasValue) batch.out = argv[++i];
+        else if (a == "--cache" && hasValue) cachePath = argv[++i];
+        else if (a == "--cache-mb" && hasValue) cacheMb = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--tc" && hasValue) tc = argv[++i];
+        else if (a == "--movetime" && hasValue) movetimeMs = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--multipv" && hasValue) multiPv = std::max(1, std::min(Analysis::MAX_LINES, std::atoi(argv[++i])));
+        else given.push_back(a);
+    }
+    if (!given.empty()) engineArgs = given;
+    const std::string &enginePath = engineArgs[0];
+    ResultCache cache;
+    if (!cachePath.empty()) {
+        if (cache.open(cachePath, cacheMb)) batch.cache = &cache;
+        else std::cerr << "Could not open cache " << cachePath << ", running without it\n";
+    }
+    if (!batchPath.empty()) return run_batch(engineArgs, batchPath, batch);
 
     Engine eng;
-    if (!launch_engine(enginePath, eng)) {
+    if (!launch_engine(engineArgs, eng)) {
         std::cerr << "Failed to start Stockfish at: " << enginePath << "\n";
         return 1;
     }
+    std::vector<std::string> options;
+    if (multiPv > 1) options.push_back("setoption name MultiPV value " + std::to_string(multiPv));
+    if (!uci_handshake(eng, options)) {
+        std::cerr << enginePath << " did not answer uci/isready\n";
+        close_engine(eng);
+        return 1;
+    }
+    if (benchRounds > 0) {
+        run_bench(eng, benchRounds);
+        close_engine(eng);
+        return 0;
+    }
 
-    send_cmd(eng, "uci");
-    read_output(eng, 1000); // discard engine ID
-    send_cmd(eng, "isready");
-    read_output(eng, 1000);
+    AnalysisPanel panel;
+#if defined(_WIN32)
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode = 0;
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+    panel.live = GetConsoleMode(console, &mode) && SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+#else
+    panel.live = isatty(1);
+#endif
+
+    GameClock clock;
+    if (!clock.parse(tc)) {
+        std::cerr << "Bad --tc " << tc << " (expected seconds+increment, e.g. 300+3)\n";
+        close_engine(eng);
+        return 1;
+    }
+    clock.pingMs = clock.overheadMs = ping_ms(eng, 5);
+    // UCI has no incremental form, so the command is kept and extended by
+    // each move rather than rebuilt from the move list every turn.
+    std::string position = "position startpos";
 
     std::vector<std::string> moves;
     bool playerIsWhite = true;
@@ -160,65 +1166,48 @@ int main() {
     print_board();
 
     bool whiteToMove = true;
-
-    // if player chose Black, engine moves first
-    if (!playerIsWhite) {
-        send_cmd(eng, "position startpos");
-        send_cmd(eng, "go movetime 1000");
-        std::string out = read_output(eng, 2000);
-        size_t p = out.find("bestmove ");
-        if (p != std::string::npos) {
-            std::string best = out.substr(p + 9);
-            best = best.substr(0, best.find(" "));
-            std::cout << "Stockfish plays: " << best << "\n";
-            moves.push_back(best);
-            apply_move(best);
-            print_board();
-        }
-        whiteToMove = false;
-    }
+    bool useClock = movetimeMs == 0;
+    if (useClock) std::cout << "Clock " << tc << " s, engine overhead " << clock.overheadMs << " ms\n";
 
     while (true) {
+        int side = whiteToMove ? 0 : 1;
+        if (useClock)
+            std::cout << "White " << GameClock::format(clock.remainingMs[0]) << "  Black "
+                      << GameClock::format(clock.remainingMs[1]) << "\n";
+        std::string mv;
+        double usedMs = 0;
         if ((whiteToMove && playerIsWhite) || (!whiteToMove && !playerIsWhite)) {
             std::cout << "> Your move: ";
-            std::string mv;
-            std::getline(std::cin, mv);
-            if (mv == "quit") break;
-            moves.push_back(mv);
-            apply_move(mv);
-            print_board();
+            auto start = std::chrono::steady_clock::now();
+            if (!std::getline(std::cin, mv) || mv == "quit") break;
+            usedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
         } else {
-            std::ostringstream pos;
-            pos << "position startpos";
-            if (!moves.empty()) {
-                pos << " moves";
-                for (auto &m : moves) pos << " " << m;
-            }
-            send_cmd(eng, pos.str());
-            send_cmd(eng, "go movetime 1000");
-
-            std::string out = read_output(eng, 2000);
-            size_t p = out.find("bestmove ");
-            if (p != std::string::npos) {
-                std::string best = out.substr(p + 9);
-                best = best.substr(0, best.find(" "));
-                if (best == "(none)") {
-                    std::cout << "Game over.\n";
-                    break;
-                }
-                std::cout << "Stockfish plays: " << best << "\n";
-                moves.push_back(best);
-                apply_move(best);
-                print_board();
+            int engineMs = 0;
+            bool cached = false;
+            std::string go = useClock ? clock.go_args(side) : "movetime " + std::to_string(movetimeMs);
+            // Under a clock the right move depends on the time left, which
+            // never repeats, so only fixed-time searches use the cache.
+            mv = engine_move(eng, position, board_fen(whiteToMove), go, usedMs, engineMs,
+                             useClock ? nullptr : batch.cache, cached, &panel);
+            if (mv.empty() || mv == "(none)" || mv == "0000") {
+                std::cout << "Game over.\n";
+                break;
             }
+            if (!cached && engineMs > 0) clock.note_overhead(usedMs, engineMs);
+            std::cout << "Stockfish plays: " << mv << "  (";
+            if (cached) std::cout << (int)(usedMs * 1000) << " us, cached)\n";
+            else std::cout << (int)usedMs << " ms)\n";
         }
+        if (useClock && !clock.charge(side, usedMs)) {
+            std::cout << (whiteToMove ? "White" : "Black") << " lost on time.\n";
+            break;
+        }
+        position += moves.empty() ? " moves " + mv : " " + mv;
+        moves.push_back(mv);
+        apply_move(mv);
+        print_board();
         whiteToMove = !whiteToMove;
     }
 
-    send_cmd(eng, "quit");
-    TerminateProcess(eng.piProc.hProcess, 0);
-    CloseHandle(eng.piProc.hThread);
-    CloseHandle(eng.piProc.hProcess);
-    CloseHandle(eng.hChildStdinWr);
-    CloseHandle(eng.hChildStdoutRd);
+    close_engine(eng);
 }